@@ -0,0 +1,72 @@
+/*****************************************************************************/
+/* MegaCartImageBuilder - Videoton TV Computer 1MByte Cart Image Builder     */
+/* Persistent cache of the compressed file contents                          */
+/*                                                                           */
+/* Copyright (C) 2021-2023 Laszlo Arvai                                      */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* This software may be modified and distributed under the terms             */
+/* of the BSD license.  See the LICENSE file for details.                    */
+/*****************************************************************************/
+
+#ifndef __CompressionCache_h
+#define __CompressionCache_h
+
+///////////////////////////////////////////////////////////////////////////////
+// Include files
+#include <wchar.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "ContentHash.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants
+#define COMPRESSION_CACHE_DEFAULT_SIZE (32 * 1024 * 1024) // default size limit of the cache file
+
+///////////////////////////////////////////////////////////////////////////////
+// Types
+
+#pragma pack(push, 1)
+
+/// <summary>
+/// Identifies one compressed data block in the cache
+/// </summary>
+typedef struct
+{
+	ContentHashValue FileHash;	// hash of the whole file content
+	uint32_t FileLength;				// length of the whole file
+	uint32_t RangeStart;				// offset of the first compressed byte within the file
+	uint32_t RangeLength;				// number of compressed bytes
+	uint8_t EncoderVersion;			// version of the compressor which created the data
+	uint8_t CompressionLevel;		// compression level used
+	uint16_t MaxOffset;				// longest sequence offset allowed
+	uint16_t ChunkSize;				// length of the independently compressed chunks (zero - one chunk)
+	uint8_t Codec;						// compression codec (ZX7 or LZB)
+} CompressionCacheKey;
+
+#pragma pack(pop)
+
+/// <summary>
+/// Cache usage statistics
+/// </summary>
+typedef struct
+{
+	int Hits;
+	int Misses;
+	int EntryCount;
+	int EvictedCount;
+	int Size;
+} CompressionCacheStatistics;
+
+///////////////////////////////////////////////////////////////////////////////
+// Function prototypes
+bool CompressionCacheLoad(const wchar_t* in_file_name, int in_size_limit);
+bool CompressionCacheSave(void);
+void CompressionCacheFree(void);
+
+bool CompressionCacheLookup(const CompressionCacheKey* in_key, uint8_t** out_data, int* out_length);
+void CompressionCacheStore(const CompressionCacheKey* in_key, const uint8_t* in_data, int in_length);
+
+void CompressionCacheGetStatistics(CompressionCacheStatistics* out_statistics);
+
+#endif
@@ -0,0 +1,37 @@
+/*****************************************************************************/
+/* MegaCartImageBuilder - Videoton TV Computer 1MByte Cart Image Builder     */
+/* File content hash functions                                               */
+/*                                                                           */
+/* Copyright (C) 2021-2023 Laszlo Arvai                                      */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* This software may be modified and distributed under the terms             */
+/* of the BSD license.  See the LICENSE file for details.                    */
+/*****************************************************************************/
+
+#ifndef __ContentHash_h
+#define __ContentHash_h
+
+///////////////////////////////////////////////////////////////////////////////
+// Include files
+#include <stdint.h>
+#include <stdbool.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Types
+
+/// <summary>
+/// 128 bit hash value of a data block
+/// </summary>
+typedef struct
+{
+	uint64_t Low;
+	uint64_t High;
+} ContentHashValue;
+
+///////////////////////////////////////////////////////////////////////////////
+// Function prototypes
+void ContentHash(ContentHashValue* out_hash, const uint8_t* in_data, int in_length);
+bool ContentHashEquals(const ContentHashValue* in_hash1, const ContentHashValue* in_hash2);
+
+#endif
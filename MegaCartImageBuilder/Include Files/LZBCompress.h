@@ -0,0 +1,66 @@
+/*****************************************************************************/
+/* MegaCartImageBuilder - Videoton TV Computer 1MByte Cart Image Builder     */
+/* LZB (byte aligned LZ77) compressor                                        */
+/*                                                                           */
+/* Copyright (C) 2021-2023 Laszlo Arvai                                      */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* This software may be modified and distributed under the terms             */
+/* of the BSD license.  See the LICENSE file for details.                    */
+/*****************************************************************************/
+
+#ifndef __LZBCompress_h
+#define __LZBCompress_h
+
+///////////////////////////////////////////////////////////////////////////////
+// Include files
+#include <stdint.h>
+#include <stdbool.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants
+
+// The compressed data is a list of sequences, each one contains a token, the literals and a match:
+//  - token: bit 7 - long offset, bits 6-4 - literal count (7: extended), bits 3-0 - match length - LZB_MIN_MATCH (15: extended)
+//  - extended literal count (one byte length or zero followed by a 16-bit length)
+//  - literals
+//  - negative match offset (one byte or two bytes for long offsets, low byte first)
+//  - extended match length (one byte length or zero followed by a 16-bit length)
+// A long offset with zero high byte is the end marker (the sequence has no match).
+#define LZB_MIN_MATCH 3								// shortest match
+#define LZB_MAX_OFFSET 0xFF00					// longest match offset (the high byte of the negative offset is not zero)
+#define LZB_MAX_SHORT_OFFSET 256			// longest match offset stored in one byte
+#define LZB_MAX_INPUT_LENGTH 0xFFFF		// longest data compressed by the encoder
+#define LZB_END_MARKER_SIZE 3					// token and two offset bytes
+
+// version of the compressed data generated by the encoder (must be changed when the encoder output changes)
+#define LZB_ENCODER_VERSION 2
+
+///////////////////////////////////////////////////////////////////////////////
+// Types
+
+/// <summary>
+/// Reads the sequences of compressed data for splitting it into segments
+/// </summary>
+typedef struct
+{
+	const uint8_t* InputData;
+	int InputLength;
+	int InputIndex;								// position of the next sequence (after the end marker when finished)
+	bool SequenceLoaded;					// the current sequence is read (its literals might be partially written)
+	const uint8_t* Literals;			// literals of the current sequence which are not written yet
+	int LiteralCount;
+	int MatchOffset;							// match offset of the current sequence (zero - end marker)
+	int MatchLength;
+	bool Finished;								// end marker is reached, all segments are written
+} LZBSegmentReader;
+
+///////////////////////////////////////////////////////////////////////////////
+// Function prototypes
+int LZBCompressBound(int in_length);
+int LZBCompress(uint8_t* out_buffer, const uint8_t* in_data, int in_length, int in_search_depth);
+
+void LZBSegmentReaderInit(LZBSegmentReader* out_reader, const uint8_t* in_data, int in_length);
+int LZBEncodeSegment(LZBSegmentReader* inout_reader, uint8_t* out_buffer, int in_max_size);
+
+#endif
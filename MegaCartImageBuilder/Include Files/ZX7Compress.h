@@ -29,19 +29,74 @@
 #define MAX_OFFSET  2176  /* range 1..2176 */
 #define MAX_LEN    65536  /* range 2..65536 */
 
-typedef struct match_t {
-    size_t index;
-    struct match_t *next;
-} Match;
+#include <stdint.h>
 
-typedef struct optimal_t {
-    size_t bits;
-    int offset;
-    int len;
-} Optimal;
+/* version of the compressed data generated by the encoder (must be changed when the encoder output changes) */
+#define ZX7_ENCODER_VERSION 2
 
-Optimal *ZX7Optimize(unsigned char *input_data, size_t input_size);
+/* compression levels */
+#define ZX7_LEVEL_GREEDY    0   /* greedy parse, fastest */
+#define ZX7_LEVEL_LAZY      1   /* greedy parse with cost based one byte lazy matching */
+#define ZX7_LEVEL_OPTIMAL   2   /* optimal parse, best ratio */
 
-unsigned char *ZX7Compress(Optimal *optimal, unsigned char *input_data, size_t input_size, size_t *output_size);
+/* optimal parse and match finder buffers, one workspace can be reused for any number of files (but by one thread at a time) */
+typedef struct zx7_workspace_t {
+    size_t capacity;            /* number of input bytes the per byte arrays can hold */
+    uint32_t *bits;             /* per byte arrays: optimal cost of the data ending at the position */
+    uint32_t *offset;           /* offset of the last sequence (zero for literal) */
+    uint32_t *len;              /* length of the last sequence (zero for literal) */
+    uint32_t *smaller_tree;     /* match finder binary tree links */
+    uint32_t *larger_tree;
+    uint32_t *heads;            /* tree roots for all two byte prefixes */
+    uint32_t *last_index;       /* last position and match length for all offsets */
+    uint32_t *last_len;
+} ZX7Workspace;
+
+/* bit writer state of one encoding, several encoders can run at the same time */
+typedef struct zx7_encoder_t {
+    unsigned char *output_data;
+    size_t output_size;
+    size_t output_index;
+    size_t bit_index;
+    int bit_count;              /* number of free bits in the byte at bit_index */
+} ZX7Encoder;
+
+/* reads the sequences of compressed data for splitting it into segments */
+typedef struct zx7_segment_reader_t {
+    const unsigned char *input_data;
+    size_t input_size;
+    size_t input_index;
+    size_t bit_index;
+    int bit_mask;               /* mask of the next bit in the byte at bit_index */
+    int first;                  /* the next segment is the first one (starts with the first literal byte) */
+    int finished;               /* end marker is reached, all segments are written */
+} ZX7SegmentReader;
+
+/* the shortest first segment (first literal byte and end marker) */
+#define ZX7_MIN_FIRST_SEGMENT_SIZE 4
+
+void ZX7WorkspaceInit(ZX7Workspace *workspace);
+
+void ZX7WorkspaceFree(ZX7Workspace *workspace);
+
+void ZX7WorkspaceReserve(ZX7Workspace *workspace, size_t input_size);
+
+int count_bits(int offset, int len);
+
+void ZX7Optimize(ZX7Workspace *workspace, unsigned char *input_data, size_t input_size, int max_offset);
+
+void ZX7FastParse(ZX7Workspace *workspace, unsigned char *input_data, size_t input_size, int lazy, int max_offset);
+
+size_t ZX7CompressedSize(ZX7Workspace *workspace, size_t input_size);
+
+void ZX7EncoderInit(ZX7Encoder *encoder, unsigned char *output_buffer, size_t output_buffer_size);
+
+size_t ZX7CompressToBuffer(ZX7Encoder *encoder, ZX7Workspace *workspace, unsigned char *input_data, size_t input_size);
+
+void ZX7SegmentReaderInit(ZX7SegmentReader *reader, const unsigned char *input_data, size_t input_size);
+
+size_t ZX7EncodeSegment(ZX7SegmentReader *reader, unsigned char *output_buffer, size_t max_size);
+
+unsigned char *ZX7Compress(ZX7Workspace *workspace, unsigned char *input_data, size_t input_size, size_t *output_size);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,356 @@
+/*****************************************************************************/
+/* MegaCartImageBuilder - Videoton TV Computer 1MByte Cart Image Builder     */
+/* Persistent cache of the compressed file contents                          */
+/*                                                                           */
+/* Copyright (C) 2021-2023 Laszlo Arvai                                      */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* This software may be modified and distributed under the terms             */
+/* of the BSD license.  See the LICENSE file for details.                    */
+/*****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "FileUtils.h"
+#include "CompressionCache.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants
+#define CACHE_FILE_MAGIC "MCZC"
+#define CACHE_FILE_FORMAT_VERSION 4
+#define INITIAL_ENTRY_CAPACITY 256	// the index size is the entry capacity (power of two)
+
+///////////////////////////////////////////////////////////////////////////////
+// Types
+
+#pragma pack(push, 1)
+
+/// <summary>
+/// Cache file header
+/// </summary>
+typedef struct
+{
+	char Magic[4];
+	uint32_t FormatVersion;
+	uint32_t Generation;		// incremented on every build, used for the least recently used eviction
+	uint32_t EntryCount;
+} CacheFileHeader;
+
+/// <summary>
+/// Header of one cache entry in the file (followed by the compressed data)
+/// </summary>
+typedef struct
+{
+	CompressionCacheKey Key;
+	uint32_t Generation;					// generation of the last build which used this entry
+	uint32_t DataLength;
+	ContentHashValue DataHash;		// hash of the compressed data for integrity check
+} CacheFileEntryHeader;
+
+#pragma pack(pop)
+
+/// <summary>
+/// Cache entry in the memory
+/// </summary>
+typedef struct
+{
+	CompressionCacheKey Key;
+	uint32_t Generation;
+	int DataLength;
+	uint8_t* Data;
+	int NextEntry;		// next entry in the same index slot or -1
+} CacheEntry;
+
+///////////////////////////////////////////////////////////////////////////////
+// Function prototypes
+static bool AddEntry(const CompressionCacheKey* in_key, uint32_t in_generation, uint8_t* in_data, int in_length);
+static int CompareEntryGeneration(const void* in_entry1, const void* in_entry2);
+static void RebuildIndex(void);
+static int GetIndexSlot(const ContentHashValue* in_file_hash);
+
+///////////////////////////////////////////////////////////////////////////////
+// Module global variables
+static wchar_t l_cache_file_name[MAX_PATH_LENGTH];
+static int l_size_limit;
+static uint32_t l_generation;
+static CacheEntry* l_entries = NULL;
+static int l_entry_count = 0;
+static int l_entry_capacity = 0;
+static int* l_index = NULL;			// first entry of the entries with the same file hash slot (-1 if the slot is empty)
+static CompressionCacheStatistics l_statistics;
+
+///////////////////////////////////////////////////////////////////////////////
+// Loads cache file. Missing cache file results empty cache, returns false only when the cache file is invalid.
+bool CompressionCacheLoad(const wchar_t* in_file_name, int in_size_limit)
+{
+	FILE* cache_file;
+	CacheFileHeader header;
+	CacheFileEntryHeader entry_header;
+	ContentHashValue data_hash;
+	uint8_t* data;
+	bool success = true;
+	uint32_t i;
+
+	wcscpy_s(l_cache_file_name, MAX_PATH_LENGTH, in_file_name);
+	l_size_limit = in_size_limit;
+	l_generation = 1;
+	memset(&l_statistics, 0, sizeof(l_statistics));
+
+	if (_wfopen_s(&cache_file, l_cache_file_name, L"rb") != 0 || cache_file == NULL)
+		return true;
+
+	// check header
+	ReadBlock(cache_file, &header, sizeof(header), &success);
+	if (success && (memcmp(header.Magic, CACHE_FILE_MAGIC, sizeof(header.Magic)) != 0 || header.FormatVersion != CACHE_FILE_FORMAT_VERSION))
+		success = false;
+
+	// load entries
+	for (i = 0; success && i < header.EntryCount; i++)
+	{
+		ReadBlock(cache_file, &entry_header, sizeof(entry_header), &success);
+
+		data = NULL;
+		if (success)
+		{
+			data = (uint8_t*)malloc(entry_header.DataLength);
+			if (data == NULL)
+				success = false;
+		}
+
+		ReadBlock(cache_file, data, entry_header.DataLength, &success);
+
+		if (success)
+		{
+			ContentHash(&data_hash, data, entry_header.DataLength);
+			success = ContentHashEquals(&data_hash, &entry_header.DataHash);
+		}
+
+		if (success)
+			success = AddEntry(&entry_header.Key, entry_header.Generation, data, entry_header.DataLength);
+
+		if (!success)
+			free(data);
+	}
+
+	fclose(cache_file);
+
+	if (success)
+	{
+		l_generation = header.Generation + 1;
+	}
+	else
+	{
+		// drop the whole content of an invalid cache
+		CompressionCacheFree();
+	}
+
+	return success;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Saves the cache file. The least recently used entries are dropped when the size limit is exceeded.
+bool CompressionCacheSave(void)
+{
+	FILE* cache_file;
+	CacheFileHeader header;
+	CacheFileEntryHeader entry_header;
+	bool success = true;
+	int size;
+	int entry_count;
+	int i;
+
+	// most recently used entries first
+	qsort(l_entries, l_entry_count, sizeof(CacheEntry), CompareEntryGeneration);
+	RebuildIndex();
+
+	// determine number of entries fitting into the size limit
+	size = sizeof(header);
+	entry_count = 0;
+	while (entry_count < l_entry_count && size + (int)sizeof(entry_header) + l_entries[entry_count].DataLength <= l_size_limit)
+	{
+		size += sizeof(entry_header) + l_entries[entry_count].DataLength;
+		entry_count++;
+	}
+
+	l_statistics.EntryCount = entry_count;
+	l_statistics.EvictedCount = l_entry_count - entry_count;
+	l_statistics.Size = size;
+
+	if (_wfopen_s(&cache_file, l_cache_file_name, L"wb") != 0 || cache_file == NULL)
+		return false;
+
+	memcpy(header.Magic, CACHE_FILE_MAGIC, sizeof(header.Magic));
+	header.FormatVersion = CACHE_FILE_FORMAT_VERSION;
+	header.Generation = l_generation;
+	header.EntryCount = entry_count;
+	WriteBlock(cache_file, &header, sizeof(header), &success);
+
+	for (i = 0; i < entry_count; i++)
+	{
+		entry_header.Key = l_entries[i].Key;
+		entry_header.Generation = l_entries[i].Generation;
+		entry_header.DataLength = l_entries[i].DataLength;
+		ContentHash(&entry_header.DataHash, l_entries[i].Data, l_entries[i].DataLength);
+
+		WriteBlock(cache_file, &entry_header, sizeof(entry_header), &success);
+		WriteBlock(cache_file, l_entries[i].Data, l_entries[i].DataLength, &success);
+	}
+
+	fclose(cache_file);
+
+	return success;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Releases all cache entries
+void CompressionCacheFree(void)
+{
+	int i;
+
+	for (i = 0; i < l_entry_count; i++)
+		free(l_entries[i].Data);
+
+	free(l_entries);
+	free(l_index);
+
+	l_entries = NULL;
+	l_index = NULL;
+	l_entry_count = 0;
+	l_entry_capacity = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Finds compressed data in the cache. The returned data belongs to the cache.
+bool CompressionCacheLookup(const CompressionCacheKey* in_key, uint8_t** out_data, int* out_length)
+{
+	int i;
+
+	for (i = (l_index != NULL) ? l_index[GetIndexSlot(&in_key->FileHash)] : -1; i >= 0; i = l_entries[i].NextEntry)
+	{
+		if (memcmp(&l_entries[i].Key, in_key, sizeof(CompressionCacheKey)) == 0)
+		{
+			l_entries[i].Generation = l_generation;
+			*out_data = l_entries[i].Data;
+			*out_length = l_entries[i].DataLength;
+			l_statistics.Hits++;
+
+			return true;
+		}
+	}
+
+	l_statistics.Misses++;
+
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Stores compressed data in the cache
+void CompressionCacheStore(const CompressionCacheKey* in_key, const uint8_t* in_data, int in_length)
+{
+	uint8_t* data;
+
+	data = (uint8_t*)malloc(in_length);
+	if (data == NULL)
+		return;
+
+	memcpy(data, in_data, in_length);
+
+	if (!AddEntry(in_key, l_generation, data, in_length))
+		free(data);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets cache statistics
+void CompressionCacheGetStatistics(CompressionCacheStatistics* out_statistics)
+{
+	*out_statistics = l_statistics;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Adds new entry to the entry table
+static bool AddEntry(const CompressionCacheKey* in_key, uint32_t in_generation, uint8_t* in_data, int in_length)
+{
+	CacheEntry* entries;
+	int* index;
+	int capacity;
+	int slot;
+
+	if (l_entry_count >= l_entry_capacity)
+	{
+		capacity = (l_entry_capacity == 0) ? INITIAL_ENTRY_CAPACITY : l_entry_capacity * 2;
+		entries = (CacheEntry*)realloc(l_entries, capacity * sizeof(CacheEntry));
+		if (entries == NULL)
+			return false;
+
+		l_entries = entries;
+
+		index = (int*)malloc(capacity * sizeof(int));
+		if (index == NULL)
+			return false;
+
+		free(l_index);
+		l_index = index;
+		l_entry_capacity = capacity;
+
+		RebuildIndex();
+	}
+
+	slot = GetIndexSlot(&in_key->FileHash);
+
+	l_entries[l_entry_count].Key = *in_key;
+	l_entries[l_entry_count].Generation = in_generation;
+	l_entries[l_entry_count].DataLength = in_length;
+	l_entries[l_entry_count].Data = in_data;
+	l_entries[l_entry_count].NextEntry = l_index[slot];
+	l_index[slot] = l_entry_count;
+	l_entry_count++;
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sort compare function, most recently used entries are the first
+static int CompareEntryGeneration(const void* in_entry1, const void* in_entry2)
+{
+	uint32_t generation1 = ((const CacheEntry*)in_entry1)->Generation;
+	uint32_t generation2 = ((const CacheEntry*)in_entry2)->Generation;
+
+	if (generation1 > generation2)
+		return -1;
+
+	if (generation1 < generation2)
+		return 1;
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Rebuilds the file hash index of the entries (the entries with the same slot are linked)
+static void RebuildIndex(void)
+{
+	int slot;
+	int i;
+
+	if (l_index == NULL)
+		return;
+
+	for (i = 0; i < l_entry_capacity; i++)
+		l_index[i] = -1;
+
+	for (i = l_entry_count - 1; i >= 0; i--)
+	{
+		slot = GetIndexSlot(&l_entries[i].Key.FileHash);
+		l_entries[i].NextEntry = l_index[slot];
+		l_index[slot] = i;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the index slot of the file hash
+static int GetIndexSlot(const ContentHashValue* in_file_hash)
+{
+	return (int)(in_file_hash->Low & (uint64_t)(l_entry_capacity - 1));
+}
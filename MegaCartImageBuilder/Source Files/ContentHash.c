@@ -0,0 +1,144 @@
+/*****************************************************************************/
+/* MegaCartImageBuilder - Videoton TV Computer 1MByte Cart Image Builder     */
+/* File content hash functions                                               */
+/*                                                                           */
+/* Copyright (C) 2021-2023 Laszlo Arvai                                      */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* This software may be modified and distributed under the terms             */
+/* of the BSD license.  See the LICENSE file for details.                    */
+/*****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes
+#include <string.h>
+#include "ContentHash.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants
+#define HASH_SEED 0x4D65676143617274ULL // 'MegaCart'
+#define HASH_C1 0x87C37B91114253D5ULL
+#define HASH_C2 0x4CF5AD432745937FULL
+
+///////////////////////////////////////////////////////////////////////////////
+// Function prototypes
+static uint64_t RotateLeft(uint64_t in_value, int in_shift);
+static uint64_t FinalMix(uint64_t in_value);
+static uint64_t ReadUInt64(const uint8_t* in_data);
+
+///////////////////////////////////////////////////////////////////////////////
+// Calculates 128 bit hash of the given data block (MurmurHash3 x64 128 bit variant)
+void ContentHash(ContentHashValue* out_hash, const uint8_t* in_data, int in_length)
+{
+	uint64_t h1 = HASH_SEED;
+	uint64_t h2 = HASH_SEED;
+	uint64_t k1;
+	uint64_t k2;
+	uint8_t tail[16];
+	int block_count = in_length / 16;
+	int i;
+
+	// process 16 byte blocks
+	for (i = 0; i < block_count; i++)
+	{
+		k1 = ReadUInt64(in_data + i * 16);
+		k2 = ReadUInt64(in_data + i * 16 + 8);
+
+		k1 *= HASH_C1;
+		k1 = RotateLeft(k1, 31);
+		k1 *= HASH_C2;
+		h1 ^= k1;
+
+		h1 = RotateLeft(h1, 27);
+		h1 += h2;
+		h1 = h1 * 5 + 0x52DCE729;
+
+		k2 *= HASH_C2;
+		k2 = RotateLeft(k2, 33);
+		k2 *= HASH_C1;
+		h2 ^= k2;
+
+		h2 = RotateLeft(h2, 31);
+		h2 += h1;
+		h2 = h2 * 5 + 0x38495AB5;
+	}
+
+	// process remaining bytes (zero padded)
+	memset(tail, 0, sizeof(tail));
+	memcpy(tail, in_data + block_count * 16, in_length % 16);
+
+	k1 = ReadUInt64(tail);
+	k2 = ReadUInt64(tail + 8);
+
+	if ((in_length % 16) > 8)
+	{
+		k2 *= HASH_C2;
+		k2 = RotateLeft(k2, 33);
+		k2 *= HASH_C1;
+		h2 ^= k2;
+	}
+
+	if ((in_length % 16) > 0)
+	{
+		k1 *= HASH_C1;
+		k1 = RotateLeft(k1, 31);
+		k1 *= HASH_C2;
+		h1 ^= k1;
+	}
+
+	// finalization
+	h1 ^= (uint64_t)in_length;
+	h2 ^= (uint64_t)in_length;
+
+	h1 += h2;
+	h2 += h1;
+
+	h1 = FinalMix(h1);
+	h2 = FinalMix(h2);
+
+	h1 += h2;
+	h2 += h1;
+
+	out_hash->Low = h1;
+	out_hash->High = h2;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Returns true if the two hash values are equal
+bool ContentHashEquals(const ContentHashValue* in_hash1, const ContentHashValue* in_hash2)
+{
+	return in_hash1->Low == in_hash2->Low && in_hash1->High == in_hash2->High;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Rotates 64 bit value left
+static uint64_t RotateLeft(uint64_t in_value, int in_shift)
+{
+	return (in_value << in_shift) | (in_value >> (64 - in_shift));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Final avalanche mixing of the hash value
+static uint64_t FinalMix(uint64_t in_value)
+{
+	in_value ^= in_value >> 33;
+	in_value *= 0xFF51AFD7ED558CCDULL;
+	in_value ^= in_value >> 33;
+	in_value *= 0xC4CEB9FE1A85EC53ULL;
+	in_value ^= in_value >> 33;
+
+	return in_value;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads little endian 64 bit value
+static uint64_t ReadUInt64(const uint8_t* in_data)
+{
+	uint64_t value = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--)
+		value = (value << 8) | in_data[i];
+
+	return value;
+}
@@ -56,6 +56,36 @@ void ChangeFileExtension(wchar_t* in_file_name, int in_buffer_length, wchar_t* i
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Inserts suffix into the file name before the extension
+void AppendFileNameSuffix(wchar_t* inout_file_name, int in_buffer_length, wchar_t* in_suffix)
+{
+	wchar_t extension[MAX_PATH_LENGTH];
+	wchar_t* extension_pos;
+	wchar_t* filename;
+
+	filename = wcsrchr(inout_file_name, '\\');
+	if (filename == NULL)
+		filename = wcsrchr(inout_file_name, '/'); // Accept either \ or /
+	if (filename == NULL)
+		filename = inout_file_name;
+
+	// the extension is the part after the last dot of the file name (not the path)
+	extension_pos = wcsrchr(filename, '.');
+	if (extension_pos != NULL)
+	{
+		wcscpy_s(extension, MAX_PATH_LENGTH, extension_pos);
+		*extension_pos = '\0';
+	}
+	else
+	{
+		extension[0] = '\0';
+	}
+
+	wcscat_s(inout_file_name, in_buffer_length, in_suffix);
+	wcscat_s(inout_file_name, in_buffer_length, extension);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Gets filename and extension from full file name
 void GetFileNameAndExtension(wchar_t* out_file_name, int in_buffer_length, wchar_t* in_path)
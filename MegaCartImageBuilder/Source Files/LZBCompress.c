@@ -0,0 +1,445 @@
+/*****************************************************************************/
+/* MegaCartImageBuilder - Videoton TV Computer 1MByte Cart Image Builder     */
+/* LZB (byte aligned LZ77) compressor                                        */
+/*                                                                           */
+/* Copyright (C) 2021-2023 Laszlo Arvai                                      */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* This software may be modified and distributed under the terms             */
+/* of the BSD license.  See the LICENSE file for details.                    */
+/*****************************************************************************/
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "LZBCompress.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants
+#define HASH_BITS 16
+#define HASH_SIZE (1 << HASH_BITS)
+#define NICE_MATCH_LENGTH 256					// the positions inside a longer match are not searched for matches
+#define LITERAL_COUNT_LIMIT 7					// literal counts from this value are extended
+#define MATCH_LENGTH_LIMIT 15					// match lengths from this value (minus LZB_MIN_MATCH) are extended
+#define LONG_OFFSET_FLAG 0x80
+
+///////////////////////////////////////////////////////////////////////////////
+// Types
+
+/// <summary>
+/// Shortest encoding of the data up to a position (optimal parse)
+/// </summary>
+typedef struct
+{
+	int Length;							// compressed length of the data up to the position (without the final sequence)
+	int SequenceCount;			// number of sequences (fewer sequences decompress faster)
+	int LiteralCount;				// number of literals after the last match
+	int MatchLength;				// length of the match ending at the position (zero - literal)
+	int MatchOffset;
+} ParseNode;
+
+///////////////////////////////////////////////////////////////////////////////
+// Function prototypes
+static uint32_t GetHash(const uint8_t* in_data);
+static void UpdateParseNode(ParseNode* inout_node, int in_length, int in_sequence_count, int in_literal_count, int in_match_length, int in_match_offset);
+static int GetExtendedLengthSize(int in_length);
+static int GetLiteralCountSize(int in_literal_count);
+static int GetMatchSize(int in_match_offset, int in_match_length);
+static int GetSequenceSize(int in_literal_count, int in_match_offset, int in_match_length);
+static int WriteExtendedLength(uint8_t* out_buffer, int in_length);
+static int WriteSequence(uint8_t* out_buffer, const uint8_t* in_literals, int in_literal_count, int in_match_offset, int in_match_length);
+static int ReadInputByte(LZBSegmentReader* inout_reader);
+static int ReadExtendedLength(LZBSegmentReader* inout_reader);
+static void ReadSequence(LZBSegmentReader* inout_reader);
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the maximal length of the compressed data (all bytes stored as literals in the final sequence, the
+// compressor falls back to this encoding when the matches don't make the data shorter)
+int LZBCompressBound(int in_length)
+{
+	return GetSequenceSize(in_length, 0, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Compresses the data into the buffer (at least LZBCompressBound bytes long). The shortest encoding is
+// selected by an optimal parse, the matches are found by a hash chain search of the given depth. Returns the
+// compressed length or zero if the data is too long or there is not enough memory.
+int LZBCompress(uint8_t* out_buffer, const uint8_t* in_data, int in_length, int in_search_depth)
+{
+	ParseNode* nodes;
+	int* heads;
+	int* chain;
+	int pos;
+	int next_pos;
+	int literal_pos;
+	int match;
+	int offset;
+	int length;
+	int max_length;
+	int best_length;
+	int skip_end;
+	int depth;
+	int output_length;
+	uint32_t hash;
+	ParseNode* node;
+
+	if (in_length > LZB_MAX_INPUT_LENGTH)
+		return 0;
+
+	nodes = (ParseNode*)malloc((in_length + 1) * sizeof(ParseNode));
+	heads = (int*)calloc(HASH_SIZE, sizeof(int));
+	chain = (int*)malloc((in_length + 1) * sizeof(int));
+	if (nodes == NULL || heads == NULL || chain == NULL)
+	{
+		free(nodes);
+		free(heads);
+		free(chain);
+		return 0;
+	}
+
+	memset(nodes, 0, sizeof(ParseNode));
+	for (pos = 1; pos <= in_length; pos++)
+		nodes[pos].Length = INT_MAX;
+
+	// find the shortest encoding of all positions (heads and chain store the positions plus one)
+	skip_end = 0;
+	for (pos = 0; pos < in_length; pos++)
+	{
+		node = &nodes[pos];
+
+		// literal
+		UpdateParseNode(&nodes[pos + 1], node->Length + 1 + GetLiteralCountSize(node->LiteralCount + 1) - GetLiteralCountSize(node->LiteralCount), node->SequenceCount, node->LiteralCount + 1, 0, 0);
+
+		if (pos + LZB_MIN_MATCH > in_length)
+			continue;
+
+		hash = GetHash(in_data + pos);
+
+		// matches, the shorter lengths are reached from the nearer offsets
+		if (pos >= skip_end)
+		{
+			max_length = in_length - pos;
+			best_length = LZB_MIN_MATCH - 1;
+			match = heads[hash];
+
+			for (depth = in_search_depth; match > 0 && depth > 0 && best_length < max_length; depth--)
+			{
+				match--;
+				offset = pos - match;
+				if (offset > LZB_MAX_OFFSET)
+					break;
+
+				if (in_data[match + best_length] == in_data[pos + best_length])
+				{
+					length = 0;
+					while (length < max_length && in_data[match + length] == in_data[pos + length])
+						length++;
+
+					// only the full length is used above the nice length
+					for (; best_length < length; best_length++)
+					{
+						if (best_length >= NICE_MATCH_LENGTH && best_length + 1 < length)
+							best_length = length - 1;
+
+						UpdateParseNode(&nodes[pos + best_length + 1], node->Length + GetMatchSize(offset, best_length + 1), node->SequenceCount + 1, 0, best_length + 1, offset);
+					}
+				}
+
+				match = chain[match];
+			}
+
+			if (best_length >= NICE_MATCH_LENGTH)
+				skip_end = pos + best_length;
+		}
+
+		chain[pos] = heads[hash];
+		heads[hash] = pos + 1;
+	}
+
+	// link the positions of the shortest encoding (the chain is reused)
+	pos = in_length;
+	while (pos > 0)
+	{
+		next_pos = pos;
+		pos -= (nodes[pos].MatchLength > 0) ? nodes[pos].MatchLength : 1;
+		chain[pos] = next_pos;
+	}
+
+	// size of the encoding (the parse doesn't follow the literal count extensions of the later runs exactly,
+	// the result might be longer than the bound when the literal runs after the matches are long)
+	output_length = 0;
+	literal_pos = 0;
+	pos = 0;
+	while (pos < in_length)
+	{
+		next_pos = chain[pos];
+		if (nodes[next_pos].MatchLength > 0)
+		{
+			output_length += GetSequenceSize(pos - literal_pos, nodes[next_pos].MatchOffset, nodes[next_pos].MatchLength);
+			literal_pos = next_pos;
+		}
+		pos = next_pos;
+	}
+
+	output_length += GetSequenceSize(in_length - literal_pos, 0, 0);
+
+	// write the sequences and the final sequence with the end marker (only the final sequence when the
+	// encoding is longer than the bound)
+	pos = (output_length > LZBCompressBound(in_length)) ? in_length : 0;
+	output_length = 0;
+	literal_pos = 0;
+	while (pos < in_length)
+	{
+		next_pos = chain[pos];
+		if (nodes[next_pos].MatchLength > 0)
+		{
+			output_length += WriteSequence(out_buffer + output_length, in_data + literal_pos, pos - literal_pos, nodes[next_pos].MatchOffset, nodes[next_pos].MatchLength);
+			literal_pos = next_pos;
+		}
+		pos = next_pos;
+	}
+
+	output_length += WriteSequence(out_buffer + output_length, in_data + literal_pos, in_length - literal_pos, 0, 0);
+
+	free(nodes);
+	free(heads);
+	free(chain);
+
+	return output_length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Initializes the segment reader for the compressed data
+void LZBSegmentReaderInit(LZBSegmentReader* out_reader, const uint8_t* in_data, int in_length)
+{
+	memset(out_reader, 0, sizeof(LZBSegmentReader));
+	out_reader->InputData = in_data;
+	out_reader->InputLength = in_length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Re-encodes the next sequences of the compressed data as a segment closed by an end marker. The literals
+// of a sequence are split between the segments when the sequence doesn't fit (the decoder keeps the
+// decompressed data and continues with the next segment). Returns the segment size (at most in_max_size) or
+// zero if the end marker doesn't fit.
+int LZBEncodeSegment(LZBSegmentReader* inout_reader, uint8_t* out_buffer, int in_max_size)
+{
+	int pos = 0;
+	int size;
+	int literal_count;
+
+	if (in_max_size < LZB_END_MARKER_SIZE)
+		return 0;
+
+	for (;;)
+	{
+		if (!inout_reader->SequenceLoaded)
+			ReadSequence(inout_reader);
+
+		// the sequence and the end marker must fit (the final sequence contains the end marker)
+		size = GetSequenceSize(inout_reader->LiteralCount, inout_reader->MatchOffset, inout_reader->MatchLength);
+		if (inout_reader->MatchOffset > 0)
+			size += LZB_END_MARKER_SIZE;
+
+		if (pos + size > in_max_size)
+			break;
+
+		pos += WriteSequence(out_buffer + pos, inout_reader->Literals, inout_reader->LiteralCount, inout_reader->MatchOffset, inout_reader->MatchLength);
+		inout_reader->SequenceLoaded = false;
+
+		if (inout_reader->MatchOffset == 0)
+		{
+			inout_reader->Finished = true;
+			return pos;
+		}
+	}
+
+	// write the literals which fit before the end marker, the rest of the sequence goes to the next segment
+	literal_count = in_max_size - pos - LZB_END_MARKER_SIZE;
+	if (literal_count > inout_reader->LiteralCount)
+		literal_count = inout_reader->LiteralCount;
+
+	while (literal_count > 0 && pos + GetSequenceSize(literal_count, 0, 0) > in_max_size)
+		literal_count--;
+
+	pos += WriteSequence(out_buffer + pos, inout_reader->Literals, literal_count, 0, 0);
+	inout_reader->Literals += literal_count;
+	inout_reader->LiteralCount -= literal_count;
+
+	return pos;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Calculates the hash of the three bytes at the given address
+static uint32_t GetHash(const uint8_t* in_data)
+{
+	return ((in_data[0] << 16 | in_data[1] << 8 | in_data[2]) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Stores the encoding in the parse node when it is shorter (or has fewer sequences) than the current one
+static void UpdateParseNode(ParseNode* inout_node, int in_length, int in_sequence_count, int in_literal_count, int in_match_length, int in_match_offset)
+{
+	if (in_length < inout_node->Length || (in_length == inout_node->Length && in_sequence_count < inout_node->SequenceCount))
+	{
+		inout_node->Length = in_length;
+		inout_node->SequenceCount = in_sequence_count;
+		inout_node->LiteralCount = in_literal_count;
+		inout_node->MatchLength = in_match_length;
+		inout_node->MatchOffset = in_match_offset;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the size of an extended length (one byte or zero and a 16-bit length)
+static int GetExtendedLengthSize(int in_length)
+{
+	return (in_length <= 0xFF) ? 1 : 3;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the size of the extended literal count (zero if the count fits into the token)
+static int GetLiteralCountSize(int in_literal_count)
+{
+	return (in_literal_count < LITERAL_COUNT_LIMIT) ? 0 : GetExtendedLengthSize(in_literal_count);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the size of a match including the token of its sequence
+static int GetMatchSize(int in_match_offset, int in_match_length)
+{
+	int size = (in_match_offset > LZB_MAX_SHORT_OFFSET) ? 3 : 2;
+
+	if (in_match_length - LZB_MIN_MATCH >= MATCH_LENGTH_LIMIT)
+		size += GetExtendedLengthSize(in_match_length);
+
+	return size;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the size of a sequence (zero match offset - end marker)
+static int GetSequenceSize(int in_literal_count, int in_match_offset, int in_match_length)
+{
+	int size = GetLiteralCountSize(in_literal_count) + in_literal_count;
+
+	if (in_match_offset == 0)
+		return size + LZB_END_MARKER_SIZE;
+
+	return size + GetMatchSize(in_match_offset, in_match_length);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Writes an extended length, returns the number of bytes written
+static int WriteExtendedLength(uint8_t* out_buffer, int in_length)
+{
+	if (in_length <= 0xFF)
+	{
+		out_buffer[0] = (uint8_t)in_length;
+		return 1;
+	}
+
+	out_buffer[0] = 0;
+	out_buffer[1] = (uint8_t)(in_length & 0xFF);
+	out_buffer[2] = (uint8_t)(in_length >> 8);
+
+	return 3;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Writes a sequence (zero match offset - end marker), returns the number of bytes written
+static int WriteSequence(uint8_t* out_buffer, const uint8_t* in_literals, int in_literal_count, int in_match_offset, int in_match_length)
+{
+	int negative_offset = (0x10000 - in_match_offset) & 0xFFFF;
+	int pos = 1;
+
+	// token
+	out_buffer[0] = (uint8_t)(((in_literal_count < LITERAL_COUNT_LIMIT) ? in_literal_count : LITERAL_COUNT_LIMIT) << 4);
+	if (in_match_offset == 0 || in_match_offset > LZB_MAX_SHORT_OFFSET)
+		out_buffer[0] |= LONG_OFFSET_FLAG;
+	if (in_match_offset > 0)
+		out_buffer[0] |= (uint8_t)((in_match_length - LZB_MIN_MATCH < MATCH_LENGTH_LIMIT) ? in_match_length - LZB_MIN_MATCH : MATCH_LENGTH_LIMIT);
+
+	// literals
+	if (in_literal_count >= LITERAL_COUNT_LIMIT)
+		pos += WriteExtendedLength(out_buffer + pos, in_literal_count);
+
+	memcpy(out_buffer + pos, in_literals, in_literal_count);
+	pos += in_literal_count;
+
+	// offset (the end marker has zero high byte)
+	out_buffer[pos++] = (uint8_t)(negative_offset & 0xFF);
+	if ((out_buffer[0] & LONG_OFFSET_FLAG) != 0)
+		out_buffer[pos++] = (uint8_t)(negative_offset >> 8);
+
+	// match length
+	if (in_match_offset > 0 && in_match_length - LZB_MIN_MATCH >= MATCH_LENGTH_LIMIT)
+		pos += WriteExtendedLength(out_buffer + pos, in_match_length);
+
+	return pos;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads the next byte of the compressed data (zero after the end of the data)
+static int ReadInputByte(LZBSegmentReader* inout_reader)
+{
+	return (inout_reader->InputIndex < inout_reader->InputLength) ? inout_reader->InputData[inout_reader->InputIndex++] : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads an extended length of the compressed data
+static int ReadExtendedLength(LZBSegmentReader* inout_reader)
+{
+	int length = ReadInputByte(inout_reader);
+
+	if (length == 0)
+	{
+		length = ReadInputByte(inout_reader);
+		length |= ReadInputByte(inout_reader) << 8;
+	}
+
+	return length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads the next sequence of the compressed data
+static void ReadSequence(LZBSegmentReader* inout_reader)
+{
+	int token = ReadInputByte(inout_reader);
+	int negative_offset;
+
+	// literals
+	inout_reader->LiteralCount = (token >> 4) & LITERAL_COUNT_LIMIT;
+	if (inout_reader->LiteralCount == LITERAL_COUNT_LIMIT)
+		inout_reader->LiteralCount = ReadExtendedLength(inout_reader);
+
+	if (inout_reader->InputIndex + inout_reader->LiteralCount > inout_reader->InputLength)
+		inout_reader->LiteralCount = inout_reader->InputLength - inout_reader->InputIndex;
+
+	inout_reader->Literals = inout_reader->InputData + inout_reader->InputIndex;
+	inout_reader->InputIndex += inout_reader->LiteralCount;
+
+	// offset
+	negative_offset = ReadInputByte(inout_reader);
+	if ((token & LONG_OFFSET_FLAG) != 0)
+		negative_offset |= ReadInputByte(inout_reader) << 8;
+	else
+		negative_offset |= 0xFF00;
+
+	// end marker or match
+	if (negative_offset < 0x100)
+	{
+		inout_reader->MatchOffset = 0;
+		inout_reader->MatchLength = 0;
+	}
+	else
+	{
+		inout_reader->MatchOffset = 0x10000 - negative_offset;
+		inout_reader->MatchLength = (token & MATCH_LENGTH_LIMIT) + LZB_MIN_MATCH;
+		if ((token & MATCH_LENGTH_LIMIT) == MATCH_LENGTH_LIMIT)
+			inout_reader->MatchLength = ReadExtendedLength(inout_reader);
+	}
+
+	inout_reader->SequenceLoaded = true;
+}
@@ -20,19 +20,65 @@
 #include <Windows.h>
 #include <CASFile.h>
 #include <FileUtils.h>
+#include "ContentHash.h"
+#include "CompressionCache.h"
 #include "ZX7Compress.h"
+#include "LZBCompress.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 // Constants
 #define CART_PAGE_SIZE 16384					// 16 kByte
-#define FILE_BUFFER_SIZE 4*1024*1024	// 4 MByte
-#define MAX_FILE_NUMBER 256
+#define FILE_BUFFER_MIN_SIZE 256*1024		// initial size of the file content buffer (grows when required)
+#define FILE_INFO_MIN_COUNT 64					// initial size of the file information array (grows when required)
 #define LINE_BUFFER_SIZE 80
+#define MAX_FILE_LENGTH 0xFFFFFF			// 24-bit file length in the directory
+#define MAX_BLOCK_FILE_LENGTH 0xFFFF	// max. length of the files loaded by one copy (autostart and compressed CAS files)
 #define CHIN_UNCOMPRESSED_BYTE_COUNT 16	// number of characters to be read using CH_IN TVC ROM function (these bytes at the beginning of each file will not be compressed)
+#define CHIN_STREAM_MAX_OFFSET 128			// max. sequence offset of the compressed non CAS files (the loader keeps this many bytes of history for CH_IN)
+#define COMPRESSED_CHUNK_SIZE 1024			// the non CAS files are compressed in independent chunks of this size (power of two, loader constant)
+
+#define ROM_FILE_FLAG_COMPRESSED 0x01	// file data is compressed (directory entry flag)
+#define ROM_FILE_FLAG_LZB 0x02				// compressed file data uses the LZB codec instead of ZX7 (directory entry flag)
+
+#define COMPRESSION_CODEC_ZX7 0			// bit stream codec, best ratio
+#define COMPRESSION_CODEC_LZB 1			// byte aligned codec, faster decompression (CAS files only)
+#define COMPRESSION_CODEC_COUNT 2
+
+#define DEFAULT_LOAD_WEIGHT 1						// load frequency weight of the files without specified weight
+#define DEFAULT_AUTOSTART_LOAD_WEIGHT 10	// load frequency weight of the autostart files without specified weight
+#define KNAPSACK_MAX_UNITS 65536				// max. number of capacity units used by the compressed file selection
+
+// Estimated Z80 T-states of the loader copy routines (used to estimate the load time of the files)
+#define TVC_CPU_CLOCK 3125000
+#define LOAD_TIME_STORED_BYTE 21			// NONCOMPRESSED_COPY, copying one byte by LDIR
+#define LOAD_TIME_STORED_PAGE 240			// NONCOMPRESSED_COPY, block setup and page switch at the page end
+#define LOAD_TIME_STORED_HW_FIX_BYTE 46	// NONCOMPRESSED_COPY, additional time of one byte in the page register range (first hardware revision)
+#define HW_FIX_PAGE_RANGE_SIZE 1024			// bytes at the end of the page in the page register address range (FC00H-FFFFH)
+#define LOAD_TIME_BIT 14							// ZX7 decoder, reading one bit
+#define LOAD_TIME_BIT_REFILL 34				// ZX7 decoder, loading the next 8 bits
+#define LOAD_TIME_LITERAL 28					// ZX7 decoder, copying one literal byte (without the flag bit)
+#define LOAD_TIME_MATCH 181						// ZX7 decoder, match with one bit length and short offset (without the bits)
+#define LOAD_TIME_MATCH_LENGTH_BIT 55	// ZX7 decoder, additional length bits of a match
+#define LOAD_TIME_MATCH_LONG_OFFSET 57	// ZX7 decoder, additional time of a long offset
+#define LOAD_TIME_MATCH_BYTE 21				// ZX7 decoder, copying one byte of a match
+#define LOAD_TIME_LZB_SEQUENCE 220		// LZB decoder, sequence with a short offset match (without the copied bytes)
+#define LOAD_TIME_LZB_LITERALS 34			// LZB decoder, additional time of the literals of a sequence
+#define LOAD_TIME_LZB_LONG_OFFSET 23	// LZB decoder, additional time of a long offset
+#define LOAD_TIME_LZB_LENGTH 39				// LZB decoder, extended length
+#define LOAD_TIME_LZB_LENGTH_16BIT 30	// LZB decoder, additional time of a 16-bit extended length
+#define LOAD_TIME_LZB_END_MARKER 200	// LZB decoder, end marker sequence (without the literals)
+#define LOAD_TIME_LZB_BYTE 21					// LZB decoder, copying one literal or match byte
 
 #define CART_TYPE_MEGACART	0
 #define CART_TYPE_MULTICART	1
 
+#define HW_REVISION_FIRST		1		// first MegaCart version (reading the page register address range changes the page)
+#define HW_REVISION_CURRENT	2
+
+#define ROM_SIZE_MODE_FIXED	0		// one image of the specified size
+#define ROM_SIZE_MODE_AUTO	1		// one image of the smallest size which fits
+#define ROM_SIZE_MODE_ALL		2		// one image of each size
+
 #define PRINT_ERROR(...) fwprintf (stderr, __VA_ARGS__)
 #define PRINT_INFO(...) fwprintf (stdout, __VA_ARGS__)
 
@@ -44,6 +90,12 @@ extern const unsigned char megacart_loader_bin[];
 extern const long int megacart_decomp_loader_bin_size;
 extern const unsigned char megacart_decomp_loader_bin[];
 
+extern const long int megacart_hwfix_loader_bin_size;
+extern const unsigned char megacart_hwfix_loader_bin[];
+
+extern const long int megacart_hwfix_decomp_loader_bin_size;
+extern const unsigned char megacart_hwfix_decomp_loader_bin[];
+
 extern const long int multicart_loader_bin_size;
 extern const unsigned char multicart_loader_bin[];
 
@@ -58,24 +110,65 @@ extern const unsigned char multicart_decomp_loader_bin[];
 /// </summary>
 typedef struct 
 {
-	wchar_t Filename[MAX_PATH_LENGTH];
+	wchar_t* Filename;
 	int BufferPos;
+	int StreamPos;							// position of the file data in the stored data stream
 	int ROMAddress;
 	int Length;
 	bool Version2xFile;
+	ContentHashValue ContentHash;
+	int DuplicateFileIndex;			// index of the earlier file with the same content or -1 if the content is unique
+	int SharedEntryIndex;				// index of the 1.x file with the same name and content (shared directory entry) or -1
+	bool EntryShared;						// directory entry of the 1.x file is shared with a 2.x file
+	int DirectoryEntryAddress;	// address of the file information in the ROM directory
+	uint8_t* CompressedData;		// compressed file content using the codec of the file (NULL if the file is stored without compression)
+	int CompressedLength;
+	int Codec;									// compression codec of the file or -1 if not specified (resolved when the files are compressed)
+	uint8_t* CodecData[COMPRESSION_CODEC_COUNT];	// compressed file content of each codec (NULL if the codec is not used for the file)
+	int CodecLength[COMPRESSION_CODEC_COUNT];
+	bool CodecCached[COMPRESSION_CODEC_COUNT];	// compressed data of the codec is loaded from the compression cache
+	bool CompressionCached;			// compressed data of all used codecs is loaded from the compression cache
+	bool Compressed;						// file is stored in compressed form in the ROM image
+	bool BaseFileKept;					// file is kept at its base image address (the storage form is fixed by the base image)
+	int LoadWeight;							// load frequency weight specified in the file list or -1 if not specified
 } ProgramFileInfo;
 
+/// <summary>
+/// Information about a file of the base image (previously created ROM image used by the stable layout)
+/// </summary>
+typedef struct
+{
+	int ROMAddress;
+	int Length;
+	bool Compressed;
+} BaseFileInfo;
+
+/// <summary>
+/// Reads the ZX7 compressed data for the load time estimation
+/// </summary>
+typedef struct
+{
+	uint8_t* Data;
+	int Length;
+	int Pos;				// position of the next byte
+	int BitPos;			// position of the byte containing the current bits
+	int BitMask;
+	int Time;				// estimated load time (T-states)
+} LoadTimeEstimator;
+
 #pragma pack(push, 1)
 
 /// <summary>
-/// Information about a file in the ROM file system
+/// Information about a file in the ROM file system (the directory entry starts with the name hash, the name
+/// length and the name without terminating zero)
 /// </summary>
 typedef struct
 {
-	char Filename[MAX_TVC_FILE_NAME_LENGTH];
 	uint16_t Address;
 	uint8_t Page;
 	uint16_t Length;
+	uint8_t LengthHigh;		// bits 16-23 of the length
+	uint8_t Flags;
 } ROMFileInfo;
 
 /// <summary>
@@ -83,11 +176,13 @@ typedef struct
 /// </summary>
 typedef struct
 {
-	uint8_t Files1xCount;	// Number of files in the image for 1.x TVC ROM version
-	uint8_t Files2xCount;	// Number of files in the image for 2.x TVC ROM version
+	uint16_t Files1xCount;	// Number of files in the image for 1.x TVC ROM version
+	uint16_t Files2xCount;	// Number of files in the image for 2.x TVC ROM version
 	uint16_t Directory1xAddress;	// Address of the directory for 1.x TVC ROM version
 	uint16_t Directory2xAddress;	// Address of the directory for 1.x TVC ROM version
 	uint16_t FilesAddress;				// Address of the file binary data
+	uint16_t Autostart1xAddress;	// Address of the file information of the autostart file for 1.x TVC ROM version
+	uint16_t Autostart2xAddress;	// Address of the file information of the autostart file for 2.x TVC ROM version
 } ROMFileSystemInfo;
 
 #pragma pack(pop)
@@ -96,13 +191,70 @@ typedef struct
 // Function prototypes
 static bool LoadFiles(void);
 static bool LoadProgramFile(ProgramFileInfo* inout_cas_file);
-static bool CreateROMImage(void);
+static bool CreateROMImages(wchar_t* in_output_file_name);
+static bool CreateROMImage(bool* out_fits);
+static bool SaveROMImage(wchar_t* in_output_file_name);
+static bool SaveDeltaImage(wchar_t* in_output_file_name);
+static bool LoadBaseImage(void);
+static bool PlanROMImage(void);
+static bool PlanROMFileSystem(void);
+static void PlanSequentialLayout(void);
+static bool PlanPageLayout(void);
+static bool PlanStableLayout(void);
+static int FindBaseFile(ProgramFileInfo* inout_file_info, uint8_t* in_base_stream, int in_base_stream_length, int* out_stored_length);
+static int AppendFileToStream(ProgramFileInfo* inout_file_info, int in_min_shared_pos);
+static bool EmitROMImage(void);
+static bool GetLoaderBinary(unsigned const char** out_loader, int* out_loader_length);
 static bool CreateROMLoader();
 static bool CreateROMDirectory();
-static bool CreateROMFileSystem();
+static int GetROMDirectoryLength(void);
+static int GetROMFileName(char* out_name, ProgramFileInfo* in_file_info);
+static uint8_t GetROMFileNameHash(char* in_name, int in_length);
+static void FindSharedDirectoryEntries(void);
 static bool ProcessFileListEntry(wchar_t* in_file_name);
+static int GetCompressionCodec(wchar_t* in_name);
+static int GetFileCodec(ProgramFileInfo* in_file_info);
+static bool ReserveFileBuffer(int in_length);
+static bool AllocateImageBuffers(void);
 static void CopyDataToROM(int length, uint8_t* in_source);
+static void AppendDataToStream(int in_length, uint8_t* in_source);
+static void AppendPaddingToStream(int in_length);
+static void AppendCompressedDataToStream(int in_length, uint8_t* in_source, int in_codec);
+static int GetStoredLength(ProgramFileInfo* in_file_info);
+static int GetPageHeaderSize(void);
+static int GetStreamROMAddress(int in_stream_pos);
+static int GetROMStreamPos(int in_rom_address);
+static int GetStreamPageStart(int in_stream_pos);
+static int GetStreamPageEnd(int in_stream_pos);
+static int CountStreamPages(int in_stream_pos, int in_length);
+static int CountPageCrossings(void);
+static int FindStoredFileContent(uint8_t* in_data, int in_length);
 static bool IsCASFile(ProgramFileInfo* in_file_info);
+static bool FindDuplicateFiles(void);
+static bool CompressFiles(void);
+static DWORD WINAPI CompressionWorkerThread(LPVOID in_parameter);
+static void CompressProgramFile(ProgramFileInfo* inout_file_info, ZX7Workspace* in_workspace);
+static void SelectFileCodecs(void);
+static void PrintCodecComparison(void);
+static bool GetCompressedRange(ProgramFileInfo* in_file_info, int* out_start, int* out_length);
+static int GetCompressionMaxOffset(ProgramFileInfo* in_file_info);
+static int GetCompressionChunkSize(ProgramFileInfo* in_file_info);
+static int GetCompressedDataBound(int in_length);
+static int SelectCompressedFiles(void);
+static bool IsCompressionWorthwhile(ProgramFileInfo* in_file_info);
+static bool OptimizeCompressedFiles(void);
+static int GetLoadWeight(int in_file_index);
+static int GetContentLoadWeight(int in_file_index);
+static int EstimateLoadTime(ProgramFileInfo* in_file_info, bool in_compressed);
+static int EstimateStoredLoadTime(int in_length);
+static int EstimateDecompressionTime(uint8_t* in_data, int in_length, int in_codec);
+static int EstimateLZBDecompressionTime(uint8_t* in_data, int in_length);
+static int ReadLZBLength(uint8_t* in_data, int in_length, int* inout_pos, int* inout_time);
+static int ReadEstimatorBit(LoadTimeEstimator* inout_estimator);
+static int GetStreamCapacity(void);
+static void GetCompressionCacheKey(ProgramFileInfo* in_file_info, int in_codec, CompressionCacheKey* out_key);
+static bool LoadCompressedFileFromCache(ProgramFileInfo* inout_file_info);
+static void StoreCompressedFilesInCache(void);
 
 ///////////////////////////////////////////////////////////////////////////////
 // Global variables
@@ -111,24 +263,59 @@ uint8_t g_megacart_page_start_bytes[] = { 'M', 'O', 'P', 'S', 0xAF, 0x32, 0x00,
 uint8_t g_multicart_page_start_bytes[] = { 'M', 'O', 'P', 'S', 0xAF, 0x32, 0x00, 0xC0, 0x32, 0x00, 0xE0 }; // XOR A; LD (0C000H), A; LD (0E000H), A
 
 int32_t g_cart_rom_size = 1024 * 1024; // ROM size, default is 1M
+int g_rom_size_mode = ROM_SIZE_MODE_FIXED;
+const int32_t g_cart_rom_sizes[] = { 128 * 1024, 256 * 1024, 512 * 1024, 1024 * 1024, 2048 * 1024, 4096 * 1024 }; // supported ROM sizes (ascending)
 
-byte g_file_buffer[FILE_BUFFER_SIZE];
+byte* g_file_buffer = NULL;
 int g_file_buffer_length;
+int g_file_buffer_size = 0;
+
+byte* g_rom_image = NULL;		// ROM image (allocated for the current ROM size)
+int g_rom_image_size = 0;
 
-byte g_rom_image[FILE_BUFFER_SIZE];
+byte* g_rom_stream = NULL;	// file data stored in the ROM image without the page headers (as the loader reads them)
+int g_rom_stream_length;
+int g_rom_stream_size = 0;
 int g_rom_image_address;
+int g_rom_image_used_length;	// used bytes of the last created ROM image (without the unused area)
 
-ProgramFileInfo g_file_info[MAX_FILE_NUMBER];
+ProgramFileInfo* g_file_info = NULL;
 int g_file_info_count;
+int g_file_info_size = 0;
 
 bool g_compressed_mode = false;
+bool g_files_compressed = false;
+bool g_compression_planned = false;	// storage form of the files is selected, the base image files must use the same form
+
+int g_thread_count = 0; // number of compression threads, 0 - use hardware thread count
+int g_compression_level = ZX7_LEVEL_OPTIMAL;
+const wchar_t* g_compression_level_names[] = { L"greedy", L"lazy", L"optimal" };
+int g_compression_codec = COMPRESSION_CODEC_ZX7;	// default codec of the CAS files
+const wchar_t* g_compression_codec_names[] = { L"ZX7", L"LZB" };
+const int g_lzb_search_depths[] = { 16, 64, 256 };	// LZB match search depth of the compression levels
+
+wchar_t g_compression_cache_file_name[MAX_PATH_LENGTH] = L""; // compression cache file, empty - cache is not used
+int g_compression_cache_size = COMPRESSION_CACHE_DEFAULT_SIZE;
+volatile LONG g_next_file_to_compress;
+
+uint8_t* g_compressed_data;	// compressed content of all files
+volatile LONG g_compressed_data_length;
 
 int g_rom_file_system_info_address;
 int g_rom_files_address;
 
 bool g_version_2x_enabled = false;
+bool g_page_layout_enabled = true;
 
 int g_cart_type = CART_TYPE_MEGACART;
+int g_hw_revision = HW_REVISION_CURRENT;
+
+wchar_t g_base_image_file_name[MAX_PATH_LENGTH] = L""; // base image of the stable layout, empty - files are placed freely
+byte* g_base_image = NULL;
+int g_base_image_size = 0;
+BaseFileInfo* g_base_file_info = NULL;	// files of the base image directory
+int g_base_file_info_count = 0;
+int g_delta_sector_size = 0;	// sector size of the delta output, 0 - delta output is not created
 
 ///////////////////////////////////////////////////////////////////////////////
 // Main function
@@ -138,7 +325,6 @@ int wmain(int argc, wchar_t** argv)
 	bool success = true;
 	int file_index = 0;
 	wchar_t output_file_name[MAX_PATH_LENGTH];
-	FILE* output_file = NULL;
 
 	// intro
 	PRINT_INFO(L"\nROM Image Builder for 1MByte TV Computer Cartridge v1.0");
@@ -171,11 +357,11 @@ int wmain(int argc, wchar_t** argv)
 						}
 						else
 						{
-							while (!feof(parameter_file))
+							while (!feof(parameter_file) && success)
 							{
 								if (fgetws(line, LINE_BUFFER_SIZE, parameter_file) != NULL)
 								{
-									ProcessFileListEntry(line);
+									success = ProcessFileListEntry(line);
 								}
 							}
 
@@ -219,28 +405,48 @@ int wmain(int argc, wchar_t** argv)
 					if (i + 1 < argc)
 					{
 						i++;
-						if (_wcsicmp(argv[i], L"512") == 0)
+						if (_wcsicmp(argv[i], L"4096") == 0)
+						{
+							g_cart_rom_size = 4096 * 1024;
+							g_rom_size_mode = ROM_SIZE_MODE_FIXED;
+						}
+						else if (_wcsicmp(argv[i], L"2048") == 0)
+						{
+							g_cart_rom_size = 2048 * 1024;
+							g_rom_size_mode = ROM_SIZE_MODE_FIXED;
+						}
+						else if (_wcsicmp(argv[i], L"1024") == 0)
+						{
+							g_cart_rom_size = 1024 * 1024;
+							g_rom_size_mode = ROM_SIZE_MODE_FIXED;
+						}
+						else if (_wcsicmp(argv[i], L"512") == 0)
 						{
 							g_cart_rom_size = 512 * 1024;
+							g_rom_size_mode = ROM_SIZE_MODE_FIXED;
+						}
+						else if (_wcsicmp(argv[i], L"256") == 0)
+						{
+							g_cart_rom_size = 256 * 1024;
+							g_rom_size_mode = ROM_SIZE_MODE_FIXED;
+						}
+						else if (_wcsicmp(argv[i], L"128") == 0)
+						{
+							g_cart_rom_size = 128 * 1024;
+							g_rom_size_mode = ROM_SIZE_MODE_FIXED;
+						}
+						else if (_wcsicmp(argv[i], L"auto") == 0)
+						{
+							g_rom_size_mode = ROM_SIZE_MODE_AUTO;
+						}
+						else if (_wcsicmp(argv[i], L"all") == 0)
+						{
+							g_rom_size_mode = ROM_SIZE_MODE_ALL;
 						}
 						else
 						{
-							if (_wcsicmp(argv[i], L"256") == 0)
-							{
-								g_cart_rom_size = 256 * 1024;
-							}
-							else
-							{
-								if (_wcsicmp(argv[i], L"128") == 0)
-								{
-									g_cart_rom_size = 128 * 1024;
-								}
-								else
-								{
-									PRINT_ERROR(L"\nInvalid ROM size.");
-									success = false;
-								}
-							}
+							PRINT_ERROR(L"\nInvalid ROM size.");
+							success = false;
 						}
 					}
 					else
@@ -250,6 +456,134 @@ int wmain(int argc, wchar_t** argv)
 					}
 					break;
 
+				// number of compression threads
+				case 'j':
+					if (i + 1 < argc)
+					{
+						i++;
+						g_thread_count = _wtoi(argv[i]);
+						if (g_thread_count < 1)
+						{
+							PRINT_ERROR(L"\nInvalid thread count.");
+							success = false;
+						}
+					}
+					else
+					{
+						PRINT_ERROR(L"\nNo parameter for option 'j'.");
+						success = false;
+					}
+					break;
+
+				// compression level
+				case 'l':
+					if (i + 1 < argc)
+					{
+						i++;
+						if (_wcsicmp(argv[i], L"0") == 0)
+						{
+							g_compression_level = ZX7_LEVEL_GREEDY;
+						}
+						else if (_wcsicmp(argv[i], L"1") == 0)
+						{
+							g_compression_level = ZX7_LEVEL_LAZY;
+						}
+						else if (_wcsicmp(argv[i], L"2") == 0)
+						{
+							g_compression_level = ZX7_LEVEL_OPTIMAL;
+						}
+						else
+						{
+							PRINT_ERROR(L"\nInvalid compression level.");
+							success = false;
+						}
+					}
+					else
+					{
+						PRINT_ERROR(L"\nNo parameter for option 'l'.");
+						success = false;
+					}
+					break;
+
+				// compression codec
+				case 'z':
+					if (i + 1 < argc)
+					{
+						i++;
+						g_compression_codec = GetCompressionCodec(argv[i]);
+						if (g_compression_codec < 0)
+						{
+							PRINT_ERROR(L"\nInvalid compression codec.");
+							success = false;
+						}
+					}
+					else
+					{
+						PRINT_ERROR(L"\nNo parameter for option 'z'.");
+						success = false;
+					}
+					break;
+
+				// compression cache file
+				case 'k':
+					if (i + 1 < argc)
+					{
+						i++;
+						wcscpy_s(g_compression_cache_file_name, MAX_PATH_LENGTH, argv[i]);
+					}
+					else
+					{
+						PRINT_ERROR(L"\nNo parameter for option 'k'.");
+						success = false;
+					}
+					break;
+
+				// compression cache size limit
+				case 'm':
+					if (i + 1 < argc)
+					{
+						i++;
+						g_compression_cache_size = _wtoi(argv[i]);
+						if (g_compression_cache_size < 1 || g_compression_cache_size > 1024 * 1024)
+						{
+							PRINT_ERROR(L"\nInvalid compression cache size.");
+							success = false;
+						}
+						g_compression_cache_size *= 1024;
+					}
+					else
+					{
+						PRINT_ERROR(L"\nNo parameter for option 'm'.");
+						success = false;
+					}
+					break;
+
+				// file placement
+				case 'p':
+					if (i + 1 < argc)
+					{
+						i++;
+						if (_wcsicmp(argv[i], L"0") == 0)
+						{
+							g_page_layout_enabled = false;
+						}
+						else if (_wcsicmp(argv[i], L"1") == 0)
+						{
+							g_page_layout_enabled = true;
+						}
+						else
+						{
+							PRINT_ERROR(L"\nInvalid file placement mode.");
+							success = false;
+						}
+					}
+					else
+					{
+						PRINT_ERROR(L"\nNo parameter for option 'p'.");
+						success = false;
+					}
+					break;
+
 				// cart type
 				case 't':
 					if (i + 1 < argc)
@@ -279,6 +613,65 @@ int wmain(int argc, wchar_t** argv)
 					}
 					break;
 
+				// hardware revision
+				case 'r':
+					if (i + 1 < argc)
+					{
+						i++;
+						if (_wcsicmp(argv[i], L"1") == 0)
+						{
+							g_hw_revision = HW_REVISION_FIRST;
+						}
+						else if (_wcsicmp(argv[i], L"2") == 0)
+						{
+							g_hw_revision = HW_REVISION_CURRENT;
+						}
+						else
+						{
+							PRINT_ERROR(L"\nInvalid hardware revision.");
+							success = false;
+						}
+					}
+					else
+					{
+						PRINT_ERROR(L"\nNo parameter for option 'r'.");
+						success = false;
+					}
+					break;
+
+				// base image
+				case 'b':
+					if (i + 1 < argc)
+					{
+						i++;
+						wcscpy_s(g_base_image_file_name, MAX_PATH_LENGTH, argv[i]);
+					}
+					else
+					{
+						PRINT_ERROR(L"\nNo parameter for option 'b'.");
+						success = false;
+					}
+					break;
+
+				// delta output
+				case 'd':
+					if (i + 1 < argc)
+					{
+						i++;
+						g_delta_sector_size = _wtoi(argv[i]);
+						if (g_delta_sector_size < 16 || g_delta_sector_size > 4096 * 1024 || (g_delta_sector_size & (g_delta_sector_size - 1)) != 0)
+						{
+							PRINT_ERROR(L"\nInvalid sector size.");
+							success = false;
+						}
+					}
+					else
+					{
+						PRINT_ERROR(L"\nNo parameter for option 'd'.");
+						success = false;
+					}
+					break;
+
 
 				// help text
 				case 'h':
@@ -298,16 +691,54 @@ int wmain(int argc, wchar_t** argv)
 					PRINT_INFO(L" -c: Forces to compressed ROM image. The data content will be compressed by ZX7 compressor\n");
 					PRINT_INFO(L"     and will be decompressed on the fly when the file is loaded. If compression if not forced\n");
 					PRINT_INFO(L"     the image builder will switch only to comressed mode when the specified files can't fit to the ROM.\n");
+					PRINT_INFO(L"     The free space of the compressed image is used to store files without compression (see load weights).\n");
 					PRINT_INFO(L" -f: Uses text file instead of the list of files in the command line. All lines in the specified text file\n");
 					PRINT_INFO(L"     is used as a file name entry.\n");
 					PRINT_INFO(L"     example: '-f filename.txt' option will use 'filename.txt' file to collect file names to be included\n");
 					PRINT_INFO(L"     on the cart. This option can be mixed with other options: '-f filename1.txt -2 -f filename2.txt'\n");
 					PRINT_INFO(L"     'filename1.txt specifies the file names for ROM 1.x version while filename2.txt specifies file names\n");
 					PRINT_INFO(L"     for ROM 2.x version.\n");
-					PRINT_INFO(L" -s: Sets ROM size. The default size is 1Mbyte. The size can be set to 512kB, 256kB or 128kB\n");
-					PRINT_INFO(L"     '-s 512' sets 512kB ROM, '-s 256' sets 256kB, '-s 128' sets 128kB ROM size\n");
+					PRINT_INFO(L"     A load frequency weight can be specified after the file name separated by comma: 'game.cas, 10'.\n");
+					PRINT_INFO(L"     In compressed mode the frequently loaded files are stored without compression when the free space\n");
+					PRINT_INFO(L"     allows it (faster loading). The default weight is 1 (10 for the autostart files), files with zero\n");
+					PRINT_INFO(L"     weight are always compressed.\n");
+					PRINT_INFO(L" -s: Sets ROM size. The default size is 1Mbyte. The size can be set to 4096kB, 2048kB, 1024kB, 512kB,\n");
+					PRINT_INFO(L"     256kB or 128kB\n");
+					PRINT_INFO(L"     '-s 4096' sets 4MB ROM, '-s 512' sets 512kB, '-s 256' sets 256kB, '-s 128' sets 128kB ROM size\n");
+					PRINT_INFO(L"     '-s auto' creates the image with the smallest size where the files fit.\n");
+					PRINT_INFO(L"     '-s all' creates one image for each size, the size is appended to the output file name\n");
+					PRINT_INFO(L"     (e.g. 'MegaCart_128k.bin'). The files are compressed only once for all sizes.\n");
+					PRINT_INFO(L" -p: Sets file placement mode. (0 - file list order, 1 - page layout (default))\n");
+					PRINT_INFO(L"     Page layout keeps the autostart and the frequently loaded files within one ROM page and minimizes\n");
+					PRINT_INFO(L"     the number of files crossing page boundaries (faster loading). '-p 0' stores the files in the\n");
+					PRINT_INFO(L"     order of the file list.\n");
 					PRINT_INFO(L" -t: Sets target card type. (0 - megacart (default), 1 - multicart)\n");
 					PRINT_INFO(L"     '-t 1' selects the multicart\n");
+					PRINT_INFO(L" -r: Sets MegaCart hardware revision. (1 - first version, 2 - current version (default))\n");
+					PRINT_INFO(L"     The first version changes the page when the address range of the page register is read, its loader\n");
+					PRINT_INFO(L"     restores the page after each byte read from this range (slower loading).\n");
+					PRINT_INFO(L" -j: Sets the number of threads used for compression. The default is the number of hardware threads.\n");
+					PRINT_INFO(L"     '-j 1' compresses the files one by one\n");
+					PRINT_INFO(L" -l: Sets compression level. (0 - greedy, 1 - lazy, 2 - optimal (default))\n");
+					PRINT_INFO(L"     Greedy and lazy levels are much faster but the compressed files are a few percent longer.\n");
+					PRINT_INFO(L"     '-l 0' selects the fastest compression\n");
+					PRINT_INFO(L" -z: Sets the compression codec of the CAS files. (zx7 - best ratio (default), lzb - faster loading)\n");
+					PRINT_INFO(L"     The byte aligned LZB codec decompresses about 1.5-2 times faster, the compressed size is similar.\n");
+					PRINT_INFO(L"     Other files are always compressed by ZX7. The codec of one file can be set in the file list\n");
+					PRINT_INFO(L"     after the file name (and the load weight): 'game.cas, 10, lzb'.\n");
+					PRINT_INFO(L" -k: Sets compression cache file. Compressed file contents are stored in this file and reused\n");
+					PRINT_INFO(L"     when the same file is compressed again with the same compression level.\n");
+					PRINT_INFO(L"     example: '-k megacart.cache'\n");
+					PRINT_INFO(L" -m: Sets the size limit of the compression cache file in kB. The default is 32768kB.\n");
+					PRINT_INFO(L"     The least recently used files are removed from the cache when the limit is exceeded.\n");
+					PRINT_INFO(L" -b: Sets base image (a previously created ROM image) for stable file placement. The unchanged files keep\n");
+					PRINT_INFO(L"     their ROM address, the new and changed files are placed into the free space or appended. The ROM size,\n");
+					PRINT_INFO(L"     the cart type, the hardware revision and the compressed mode of the base image are used.\n");
+					PRINT_INFO(L"     example: '-b MegaCart_old.bin'\n");
+					PRINT_INFO(L" -d: Creates delta output with the sectors differing from the base image (requires -b). The parameter is\n");
+					PRINT_INFO(L"     the sector size in bytes. The changed sectors are stored in the '_delta' suffixed output file, the\n");
+					PRINT_INFO(L"     list of their addresses in the '_delta.txt' suffixed sector map file.\n");
+					PRINT_INFO(L"     example: '-d 16384' writes the changed ROM pages, '-d 4096' writes the changed 4kB sectors\n");
 					success = false;
 					break;
 			}
@@ -321,6 +752,30 @@ int wmain(int argc, wchar_t** argv)
 		i++;
 	}
 
+	// use all hardware threads by default
+	if (g_thread_count == 0)
+	{
+		g_thread_count = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+		if (g_thread_count < 1)
+			g_thread_count = 1;
+	}
+
+	// load base image of the stable layout
+	if (success && g_base_image_file_name[0] != '\0')
+		success = LoadBaseImage();
+
+	if (success && g_hw_revision == HW_REVISION_FIRST && g_cart_type != CART_TYPE_MEGACART)
+	{
+		PRINT_ERROR(L"\nHardware revision is supported only for MegaCart.");
+		success = false;
+	}
+
+	if (success && g_delta_sector_size > 0 && g_base_image == NULL)
+	{
+		PRINT_ERROR(L"\nDelta output requires a base image (option 'b').");
+		success = false;
+	}
+
 	// print mode
 	if(success)
 	{
@@ -328,7 +783,10 @@ int wmain(int argc, wchar_t** argv)
 		switch (g_cart_type)
 		{
 			case CART_TYPE_MEGACART:
-				PRINT_INFO(L"\nMegaCart Mode.\n");
+				if (g_hw_revision == HW_REVISION_FIRST)
+					PRINT_INFO(L"\nMegaCart Mode (first hardware revision).\n");
+				else
+					PRINT_INFO(L"\nMegaCart Mode.\n");
 				break;
 
 			case CART_TYPE_MULTICART:
@@ -344,20 +802,10 @@ int wmain(int argc, wchar_t** argv)
 		success = LoadFiles();
 	}
 
-	// Creates ROM image
-	if (success)
-	{
-		success = CreateROMImage();
-	}
-
-	// saves ROM image
+	// Creates and saves ROM image(s)
 	if (success)
 	{
-		if (_wfopen_s(&output_file, output_file_name, L"wb") == 0 && output_file != NULL)
-		{
-			fwrite(g_rom_image, g_cart_rom_size, 1, output_file);
-			fclose(output_file);
-		}
+		success = CreateROMImages(output_file_name);
 	}
 
 	return (success) ? 0 : -1;
@@ -370,6 +818,11 @@ static bool ProcessFileListEntry(wchar_t* in_file_name)
 {
 	bool success = true;
 	int i, j;
+	int load_weight = -1;
+	int codec = -1;
+	bool field_found;
+	wchar_t* separator;
+	ProgramFileInfo* file_info;
 
 	// trim filename
 	i = wcslen(in_file_name);
@@ -395,71 +848,244 @@ static bool ProcessFileListEntry(wchar_t* in_file_name)
 	}
 	in_file_name[j] = '\0';
 
+	// check for load weight and codec (number or codec name after the commas, e.g. 'game.cas, 10, lzb')
+	do
+	{
+		field_found = false;
+		separator = wcsrchr(in_file_name, L',');
+		if (separator != NULL)
+		{
+			i = 1;
+			while (iswspace(separator[i]))
+				i++;
+
+			j = i;
+			while (iswdigit(separator[j]))
+				j++;
+
+			if (j > i && separator[j] == '\0' && load_weight < 0)
+			{
+				load_weight = _wtoi(separator + i);
+				field_found = true;
+			}
+			else if (codec < 0 && GetCompressionCodec(separator + i) >= 0)
+			{
+				codec = GetCompressionCodec(separator + i);
+				field_found = true;
+			}
+
+			// remove field from the file name
+			if (field_found)
+			{
+				*separator = '\0';
+				i = wcslen(in_file_name);
+				while (i > 0 && iswspace(in_file_name[i - 1]))
+					in_file_name[--i] = '\0';
+			}
+		}
+	} while (field_found);
+
 	// check for empty file
 	if (wcslen(in_file_name) == 0)
 		return true;
 
+	// grow file information array
+	if (g_file_info_count >= g_file_info_size)
+	{
+		i = (g_file_info_size > 0) ? g_file_info_size * 2 : FILE_INFO_MIN_COUNT;
+		file_info = (ProgramFileInfo*)realloc(g_file_info, i * sizeof(ProgramFileInfo));
+		if (file_info == NULL)
+		{
+			PRINT_ERROR(L"\nInsufficient memory!");
+			return false;
+		}
+
+		g_file_info = file_info;
+		g_file_info_size = i;
+	}
+
 	// filename found
-	wcsncpy_s(g_file_info[g_file_info_count].Filename, MAX_PATH_LENGTH, in_file_name, MAX_PATH_LENGTH);
-	g_file_info[g_file_info_count].Version2xFile = g_version_2x_enabled;
+	file_info = &g_file_info[g_file_info_count];
+	memset(file_info, 0, sizeof(ProgramFileInfo));
+
+	file_info->Filename = _wcsdup(in_file_name);
+	if (file_info->Filename == NULL)
+	{
+		PRINT_ERROR(L"\nInsufficient memory!");
+		return false;
+	}
+
+	file_info->Version2xFile = g_version_2x_enabled;
+	file_info->LoadWeight = load_weight;
+	file_info->Codec = codec;
 	g_file_info_count++;
 
 	return success;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Loads all CAS files
-static bool LoadFiles()
+// Gets the compression codec by its name (-1 if the name is invalid)
+static int GetCompressionCodec(wchar_t* in_name)
 {
 	int i;
-	bool success = true;
 
-	for (i = 0; i < g_file_info_count && success; i++)
+	for (i = 0; i < COMPRESSION_CODEC_COUNT; i++)
 	{
-		if (i > 0 && g_file_info[i].Version2xFile && !g_file_info[i - 1].Version2xFile)
-			PRINT_INFO(L"\n*** Loading ROM 2.x files ***");
-
-		success = LoadProgramFile(&g_file_info[i]);
+		if (_wcsicmp(in_name, g_compression_codec_names[i]) == 0)
+			return i;
 	}
 
-	return success;
+	return -1;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Load program file
-static bool LoadProgramFile(ProgramFileInfo* inout_program_file)
+// Makes room for the given number of bytes at the end of the file content buffer
+static bool ReserveFileBuffer(int in_length)
 {
-	FILE* program_file = NULL;
-	bool success = true;
-	CASUPMHeaderType upm_header;
-	CASProgramFileHeaderType program_header;
-	wchar_t display_filename[MAX_PATH_LENGTH];
-	wchar_t file_extension[MAX_PATH_LENGTH];
-	bool cas_file_type = true;
+	byte* buffer;
+	int size;
 
-	// convert and copy file name
-	GetFileNameAndExtension(display_filename, MAX_PATH_LENGTH, inout_program_file->Filename);
-	PRINT_INFO(L"\nLoading: %s", display_filename);
+	if (g_file_buffer_length + in_length <= g_file_buffer_size)
+		return true;
 
-	// determine file type by extension
-	GetExtension(file_extension, display_filename);
-	if (_wcsicmp(file_extension, L"CAS") != 0)
-		cas_file_type = false;
+	size = (g_file_buffer_size > 0) ? g_file_buffer_size : FILE_BUFFER_MIN_SIZE;
+	while (size < g_file_buffer_length + in_length)
+		size *= 2;
 
-	// open program file
-	if (_wfopen_s(&program_file, inout_program_file->Filename, L"rb") != 0 || program_file == NULL)
+	buffer = (byte*)realloc(g_file_buffer, size);
+	if (buffer == NULL)
 	{
-		PRINT_ERROR(L"\nCan't open file!");
+		PRINT_ERROR(L"\nInsufficient memory!");
 		return false;
 	}
 
-	if (cas_file_type)
+	g_file_buffer = buffer;
+	g_file_buffer_size = size;
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocates the ROM image for the current ROM size and the stored data stream. The stream must hold all
+// files even if they don't fit into the ROM: the compressed data is at most 9 bits per byte and each file
+// can be preceded by less than one page of alignment padding.
+static bool AllocateImageBuffers(void)
+{
+	byte* buffer;
+	int stream_size = CART_PAGE_SIZE;
+
+	for (int i = 0; i < g_file_info_count; i++)
 	{
-		// load UPM header
-		ReadBlock(program_file, &upm_header, sizeof(upm_header), &success);
+		if (g_file_info[i].DuplicateFileIndex < 0)
+			stream_size += g_file_info[i].Length + g_file_info[i].Length / 4 + CART_PAGE_SIZE;
+	}
 
-		// load program header
-		ReadBlock(program_file, &program_header, sizeof(program_header), &success);
+	// the stable layout keeps the files at their base image position and compares the compressed data
+	// after the end of the ROM
+	if (g_base_image != NULL)
+		stream_size += g_cart_rom_size + 2 * CART_PAGE_SIZE;
+
+	if (g_rom_image_size < g_cart_rom_size)
+	{
+		buffer = (byte*)realloc(g_rom_image, g_cart_rom_size);
+		if (buffer == NULL)
+		{
+			PRINT_ERROR(L"\nInsufficient memory!");
+			return false;
+		}
+
+		g_rom_image = buffer;
+		g_rom_image_size = g_cart_rom_size;
+	}
+
+	if (g_rom_stream_size < stream_size)
+	{
+		buffer = (byte*)realloc(g_rom_stream, stream_size);
+		if (buffer == NULL)
+		{
+			PRINT_ERROR(L"\nInsufficient memory!");
+			return false;
+		}
+
+		g_rom_stream = buffer;
+		g_rom_stream_size = stream_size;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Loads all CAS files
+static bool LoadFiles()
+{
+	int i;
+	bool success = true;
+	bool autostart;
+
+	for (i = 0; i < g_file_info_count && success; i++)
+	{
+		autostart = (i == 0);
+		if (i > 0 && g_file_info[i].Version2xFile && !g_file_info[i - 1].Version2xFile)
+		{
+			PRINT_INFO(L"\n*** Loading ROM 2.x files ***");
+			autostart = true;
+		}
+
+		success = LoadProgramFile(&g_file_info[i]);
+
+		// autostart file is loaded by one copy
+		if (success && autostart && g_file_info[i].Length > MAX_BLOCK_FILE_LENGTH)
+		{
+			PRINT_ERROR(L"\nAutostart file is too long!");
+			success = false;
+		}
+	}
+
+	if (success)
+		success = FindDuplicateFiles();
+
+	if (success)
+		FindSharedDirectoryEntries();
+
+	return success;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Load program file
+static bool LoadProgramFile(ProgramFileInfo* inout_program_file)
+{
+	FILE* program_file = NULL;
+	bool success = true;
+	CASUPMHeaderType upm_header;
+	CASProgramFileHeaderType program_header;
+	wchar_t display_filename[MAX_PATH_LENGTH];
+	wchar_t file_extension[MAX_PATH_LENGTH];
+	bool cas_file_type = true;
+	long file_length = 0;
+
+	// convert and copy file name
+	GetFileNameAndExtension(display_filename, MAX_PATH_LENGTH, inout_program_file->Filename);
+	PRINT_INFO(L"\nLoading: %s", display_filename);
+
+	// determine file type by extension
+	GetExtension(file_extension, display_filename);
+	if (_wcsicmp(file_extension, L"CAS") != 0)
+		cas_file_type = false;
+
+	// open program file
+	if (_wfopen_s(&program_file, inout_program_file->Filename, L"rb") != 0 || program_file == NULL)
+	{
+		PRINT_ERROR(L"\nCan't open file!");
+		return false;
+	}
+
+	if (cas_file_type)
+	{
+		// load UPM header
+		ReadBlock(program_file, &upm_header, sizeof(upm_header), &success);
+
+		// load program header
+		ReadBlock(program_file, &program_header, sizeof(program_header), &success);
 
 		// Check validity
 		if (!CASCheckHeaderValidity(&program_header))
@@ -473,37 +1099,40 @@ static bool LoadProgramFile(ProgramFileInfo* inout_program_file)
 			PRINT_ERROR(L"\nInvalid file!");
 			success = false;
 		}
+
+		file_length = program_header.FileLength;
 	}
 	else
 	{
 		// determine length
 		fseek(program_file, 0, SEEK_END);
 
-		program_header.FileLength = (uint16_t)ftell(program_file);
+		file_length = ftell(program_file);
 		fseek(program_file, 0, SEEK_SET);
-	}
 
-	// check size
-	if (success)
-	{
-		if (g_file_buffer_length + program_header.FileLength >= FILE_BUFFER_SIZE)
+		if (file_length > MAX_FILE_LENGTH)
 		{
-			PRINT_ERROR(L"\nToo many file specified!");
+			PRINT_ERROR(L"\nFile is too long!");
 			success = false;
 		}
 	}
 
+	// make room for the file content
+	if (success)
+		success = ReserveFileBuffer(file_length);
+
 	// load program data
 	if (success)
 	{
-		ReadBlock(program_file, g_file_buffer + g_file_buffer_length, program_header.FileLength, &success);
+		ReadBlock(program_file, g_file_buffer + g_file_buffer_length, file_length, &success);
 
 		if (success)
 		{
-			inout_program_file->Length = program_header.FileLength;
+			inout_program_file->Length = file_length;
 			inout_program_file->BufferPos = g_file_buffer_length;
-			g_file_buffer_length += program_header.FileLength;
+			g_file_buffer_length += file_length;
 			inout_program_file->ROMAddress = 0;
+			ContentHash(&inout_program_file->ContentHash, g_file_buffer + inout_program_file->BufferPos, inout_program_file->Length);
 		}
 		else
 		{
@@ -520,56 +1149,33 @@ static bool LoadProgramFile(ProgramFileInfo* inout_program_file)
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Creates ROM image
-static bool CreateROMImage(void)
+// Creates ROM image. out_fits is set to false when the files don't fit into the ROM (the image is not created),
+// returns false on other errors.
+static bool CreateROMImage(bool* out_fits)
 {
 	bool success = true;
 
-	do
-	{
-		g_rom_image_address = 0;
-
-		// load loader code
-		if (success)
-			success = CreateROMLoader();
+	*out_fits = false;
 
-		if (success)
-		{
-			// update addresses
-			g_rom_file_system_info_address = g_rom_image_address - sizeof(ROMFileSystemInfo);
-			g_rom_files_address = g_rom_file_system_info_address + sizeof(ROMFileSystemInfo) + sizeof(ROMFileInfo) * g_file_info_count;
-			g_rom_image_address = g_rom_files_address;
+	success = AllocateImageBuffers();
 
-			if (g_compressed_mode)
-				PRINT_INFO(L"\nBuilding Compressed ROM file system.");
-			else
-				PRINT_INFO(L"\nBuilding ROM file system.");
+	// plan image layout, switch to compressed mode when the files don't fit into the ROM
+	if (success)
+		success = PlanROMImage();
 
-			success = CreateROMFileSystem();
-		}
+	if (success && g_rom_image_address >= g_cart_rom_size && !g_compressed_mode)
+	{
+		g_compressed_mode = true;
+		success = PlanROMImage();
+	}
 
-		// check if image is fit into the ROM
-		if (success && g_rom_image_address >= g_cart_rom_size)
-		{
-			if (g_compressed_mode)
-			{
-				PRINT_ERROR(L"\nCartridge memory is too low!");
-				success = false;
-			}
-			else
-			{
-				// try compressed mode
-				g_compressed_mode = true;
-			}
-		}
-		else
-		{
-			// add directory to the image 
-			if (success)
-				success = CreateROMDirectory();
-		}
+	// check if image is fit into the ROM
+	if (success)
+		*out_fits = (g_rom_image_address < g_cart_rom_size);
 
-	} while (success && g_rom_image_address >= g_cart_rom_size);
+	// create image using the planned layout
+	if (success && *out_fits)
+		success = EmitROMImage();
 
 	// display statistics
 	if (g_compressed_mode)
@@ -579,8 +1185,10 @@ static bool CreateROMImage(void)
 
 	PRINT_INFO(L" %d bytes used, %d bytes free, %d total bytes (%dkB)", g_rom_image_address, g_cart_rom_size - g_rom_image_address, g_cart_rom_size, g_cart_rom_size / 1024);
 
+	g_rom_image_used_length = g_rom_image_address;
+
 	// fill remaining bytes with FFH
-	if (success)
+	if (success && *out_fits)
 	{
 		while (g_rom_image_address < g_cart_rom_size)
 		{
@@ -609,231 +1217,2171 @@ static bool CreateROMImage(void)
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Creates loader code
-static bool CreateROMLoader()
+// Creates and saves the ROM images of the selected size mode. The loaded files, the duplicate search and
+// the compression results are shared by all sizes, only the layout is planned again for each size.
+static bool CreateROMImages(wchar_t* in_output_file_name)
 {
-	unsigned const char* loader;
-	int loader_length;
+	int used_bytes[sizeof(g_cart_rom_sizes) / sizeof(g_cart_rom_sizes[0])];
+	bool compressed[sizeof(g_cart_rom_sizes) / sizeof(g_cart_rom_sizes[0])];
+	bool fits[sizeof(g_cart_rom_sizes) / sizeof(g_cart_rom_sizes[0])];
+	int size_count = sizeof(g_cart_rom_sizes) / sizeof(g_cart_rom_sizes[0]);
+	int size_index;
+	int tried_count = 0;
+	int image_count = 0;
+	bool compression_forced = g_compressed_mode;
+	bool success = true;
+	wchar_t file_name[MAX_PATH_LENGTH];
+	wchar_t suffix[16];
 
-	switch (g_cart_type)
+	if (g_rom_size_mode == ROM_SIZE_MODE_FIXED)
 	{
-		case CART_TYPE_MEGACART:
-			if (g_compressed_mode)
-			{
-				loader = megacart_decomp_loader_bin;
-				loader_length = megacart_decomp_loader_bin_size;
-			}
-			else
-			{
-				loader = megacart_loader_bin;
-				loader_length = megacart_loader_bin_size;
-			}
-			break;
+		success = CreateROMImage(&fits[0]);
 
-		case CART_TYPE_MULTICART:
-			if (g_compressed_mode)
-			{
-				loader = multicart_decomp_loader_bin;
-				loader_length = multicart_decomp_loader_bin_size;
-			}
-			else
-			{
-				loader = multicart_loader_bin;
-				loader_length = multicart_loader_bin_size;
-			}
-			break;
+		if (success && !fits[0])
+		{
+			PRINT_ERROR(L"\nCartridge memory is too low!");
+			success = false;
+		}
 
-		default:
-			return false;
-	}
+		if (success)
+			success = SaveROMImage(in_output_file_name);
 
-	// copy loader to ROM image
-	memcpy(g_rom_image, loader, loader_length);
+		if (success && g_delta_sector_size > 0)
+			success = SaveDeltaImage(in_output_file_name);
 
-	// update ROM address
-	g_rom_image_address = loader_length;
+		return success;
+	}
 
-	return true;
-}
+	for (size_index = 0; size_index < size_count && success; size_index++)
+	{
+		// the smallest size is already found
+		if (g_rom_size_mode == ROM_SIZE_MODE_AUTO && image_count > 0)
+			break;
 
-///////////////////////////////////////////////////////////////////////////////
-// Creates directory on the ROM image
-static bool CreateROMDirectory()
-{
-	ROMFileInfo* file_info;
-	int file_info_address;
-	int file_count = 0;
-	bool file_system_version2x = false;
-	wchar_t buffer[MAX_PATH_LENGTH];
+		g_cart_rom_size = g_cart_rom_sizes[size_index];
+		g_compressed_mode = compression_forced;
 
-	ROMFileSystemInfo* file_system_info = (ROMFileSystemInfo*)(g_rom_image + g_rom_file_system_info_address);
-	file_system_info->FilesAddress = g_rom_files_address;
-	file_system_info->Directory1xAddress = g_rom_file_system_info_address + sizeof(ROMFileSystemInfo);
+		PRINT_INFO(L"\n\n*** Building %dkB ROM image ***", g_cart_rom_size / 1024);
 
-	// create directory entries
-	for (int i = 0; i < g_file_info_count; i++)
-	{
-		file_info_address = g_rom_file_system_info_address + sizeof(ROMFileSystemInfo) + i * sizeof(ROMFileInfo);
-		file_info = (ROMFileInfo*)(g_rom_image + file_info_address);
+		// only the 'doesn't fit' result is recorded, the other errors stop the build
+		success = CreateROMImage(&fits[size_index]);
+		if (!success)
+			break;
 
-		// change to 2x ROM version if required
-		if (g_file_info[i].Version2xFile && !file_system_version2x)
-		{
-			file_system_version2x = true;
-			file_system_info->Files1xCount = (uint8_t)file_count;
-			file_count = 0;
-			file_system_info->Directory2xAddress = (uint16_t)file_info_address;
-		}
+		compressed[size_index] = g_compressed_mode;
+		used_bytes[size_index] = g_rom_image_used_length;
+		tried_count++;
 
-		// convert and copy file name
-		GetFileNameAndExtension(buffer, MAX_PATH_LENGTH, g_file_info[i].Filename);
-		_wcsupr_s(buffer, MAX_PATH_LENGTH);
-		PCToTVCFilenameAndExtension(file_info->Filename, buffer);
+		if (fits[size_index])
+		{
+			wcscpy_s(file_name, MAX_PATH_LENGTH, in_output_file_name);
 
-		file_info->Address = (g_file_info[i].ROMAddress %CART_PAGE_SIZE);
-		file_info->Page = (g_file_info[i].ROMAddress / CART_PAGE_SIZE);
-		file_info->Length = (uint16_t)g_file_info[i].Length;
+			// the size is appended to the file name when all sizes are created
+			if (g_rom_size_mode == ROM_SIZE_MODE_ALL)
+			{
+				swprintf_s(suffix, sizeof(suffix) / sizeof(suffix[0]), L"_%dk", g_cart_rom_size / 1024);
+				AppendFileNameSuffix(file_name, MAX_PATH_LENGTH, suffix);
+			}
 
-		file_count++;
+			success = SaveROMImage(file_name);
+			image_count++;
+		}
 	}
 
-	// update file system info
-	if (file_system_version2x)
+	// display capacity table
+	PRINT_INFO(L"\n\nROM size capacity:");
+	PRINT_INFO(L"\n   size mode       used bytes  free bytes");
+	for (size_index = 0; size_index < tried_count; size_index++)
 	{
-		file_system_info->Files2xCount = file_count;
+		PRINT_INFO(L"\n %4dkB %-10s %10d  %10d%s", g_cart_rom_sizes[size_index] / 1024, compressed[size_index] ? L"compressed" : L"stored", used_bytes[size_index],
+			g_cart_rom_sizes[size_index] - used_bytes[size_index], fits[size_index] ? L"" : L"  (doesn't fit)");
 	}
-	else
+
+	if (success && image_count == 0)
 	{
-		file_system_info->Files1xCount = file_count;
-		file_system_info->Directory2xAddress = file_system_info->Directory1xAddress;
-		file_system_info->Files2xCount = file_system_info->Files1xCount;
+		PRINT_ERROR(L"\nThe files don't fit into any ROM size!");
+		success = false;
 	}
 
-	return true;
+	return success;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Creates files on the ROM image
-static bool CreateROMFileSystem()
+// Saves the ROM image
+static bool SaveROMImage(wchar_t* in_output_file_name)
 {
-	int j;
-	uint8_t* compressed_data = NULL;
-	size_t compressed_size = 0;
-	int length;
-	uint8_t* source;
-	bool multiple_file;
+	FILE* output_file = NULL;
 
-	// generate files in the ROM
-	for (int i = 0; i < g_file_info_count; i++)
+	if (_wfopen_s(&output_file, in_output_file_name, L"wb") != 0 || output_file == NULL)
 	{
-		// check if file is already in the ROM image
-		multiple_file = false;
-		j = 0;
-		while (j < i)
-		{
-			// compare length
-			if (g_file_info[i].Length == g_file_info[j].Length)
-			{
-				uint8_t* ipos = &g_file_buffer[g_file_info[i].BufferPos];
-				uint8_t* jpos = &g_file_buffer[g_file_info[j].BufferPos];
+		PRINT_ERROR(L"\nCan't create output file!");
+		return false;
+	}
 
-				// compare content if length is same
-				multiple_file = true;
-				for (int pos = 0; pos < g_file_info[i].Length; pos++)
-				{
-					if (*ipos != *jpos)
-					{
-						multiple_file = false;
-						break;
-					}
+	fwrite(g_rom_image, g_cart_rom_size, 1, output_file);
+	fclose(output_file);
 
-					ipos++;
-					jpos++;
-				}
-			}
+	return true;
+}
 
-			if (multiple_file)
-			{
-				break;
-			}
-			else
-			{
-				j++;
-			}
-		}
+///////////////////////////////////////////////////////////////////////////////
+// Saves the sectors of the ROM image which differ from the base image ('_delta' suffixed file) and the sector
+// map ('_delta.txt' suffixed file) containing the ROM address of the changed sectors
+static bool SaveDeltaImage(wchar_t* in_output_file_name)
+{
+	FILE* delta_file = NULL;
+	FILE* map_file = NULL;
+	wchar_t delta_file_name[MAX_PATH_LENGTH];
+	wchar_t map_file_name[MAX_PATH_LENGTH];
+	wchar_t display_filename[MAX_PATH_LENGTH];
+	int sector_size = g_delta_sector_size;
+	int sector_count;
+	int changed_count = 0;
+	int address;
 
-		if (multiple_file)
-		{
-			// file already included in the image, copy only the address
-			g_file_info[i].ROMAddress = g_file_info[j].ROMAddress;
-		}
-		else
-		{
-			// update ROM address
-			g_file_info[i].ROMAddress = g_rom_image_address;
+	if (sector_size > g_cart_rom_size)
+		sector_size = g_cart_rom_size;
 
-			if (g_compressed_mode)
-			{
-				if (IsCASFile(&g_file_info[i]))
-				{
-					compressed_data = ZX7Compress(ZX7Optimize(g_file_buffer + g_file_info[i].BufferPos, g_file_info[i].Length), g_file_buffer + g_file_info[i].BufferPos, g_file_info[i].Length, &compressed_size);
-					length = (int)compressed_size;
-					source = compressed_data;
-				}
-				else
-				{
-					// compression mode
-					if (g_file_info[i].Length > CHIN_UNCOMPRESSED_BYTE_COUNT)
-					{
-						// copy first bytes of each file (without compression)
-						CopyDataToROM(CHIN_UNCOMPRESSED_BYTE_COUNT, (uint8_t*)(g_file_buffer + g_file_info[i].BufferPos));
+	sector_count = g_cart_rom_size / sector_size;
 
-						// copy remaining bytes using compression
-						compressed_data = ZX7Compress(ZX7Optimize(g_file_buffer + g_file_info[i].BufferPos + CHIN_UNCOMPRESSED_BYTE_COUNT, g_file_info[i].Length - CHIN_UNCOMPRESSED_BYTE_COUNT), g_file_buffer + g_file_info[i].BufferPos + CHIN_UNCOMPRESSED_BYTE_COUNT, g_file_info[i].Length - CHIN_UNCOMPRESSED_BYTE_COUNT, &compressed_size);
-						length = (int)compressed_size;
-						source = compressed_data;
-					}
-					else
-					{
-						// store only since the file length is smaller than CHIN_BYTE_COUNT
-						source = (uint8_t*)(g_file_buffer + g_file_info[i].BufferPos);
-						length = g_file_info[i].Length;
-					}
-				}
-			}
-			else
-			{
-				// store mode (no compression)
-				source = (uint8_t*)(g_file_buffer + g_file_info[i].BufferPos);
-				length = g_file_info[i].Length;
-			}
+	wcscpy_s(delta_file_name, MAX_PATH_LENGTH, in_output_file_name);
+	AppendFileNameSuffix(delta_file_name, MAX_PATH_LENGTH, L"_delta");
 
-			// copy file to the ROM image
-			CopyDataToROM(length, source);
+	wcscpy_s(map_file_name, MAX_PATH_LENGTH, delta_file_name);
+	if (wcsrchr(map_file_name, '.') != NULL)
+		ChangeFileExtension(map_file_name, MAX_PATH_LENGTH, L"txt");
+	else
+		wcscat_s(map_file_name, MAX_PATH_LENGTH, L".txt");
 
-			if(g_compressed_mode)
-			{
-				free(compressed_data);
-			}
+	if (_wfopen_s(&delta_file, delta_file_name, L"wb") != 0 || delta_file == NULL)
+	{
+		PRINT_ERROR(L"\nCan't create delta file!");
+		return false;
+	}
+
+	if (_wfopen_s(&map_file, map_file_name, L"wt") != 0 || map_file == NULL)
+	{
+		PRINT_ERROR(L"\nCan't create sector map file!");
+		fclose(delta_file);
+		return false;
+	}
+
+	GetFileNameAndExtension(display_filename, MAX_PATH_LENGTH, g_base_image_file_name);
+	fwprintf(map_file, L"; Sectors differing from the base image '%s', sector size: %d bytes\n", display_filename, sector_size);
+	fwprintf(map_file, L"; sector  ROM address  delta file offset\n");
+
+	// store the changed sectors
+	for (address = 0; address < g_cart_rom_size; address += sector_size)
+	{
+		if (memcmp(g_rom_image + address, g_base_image + address, sector_size) != 0)
+		{
+			fwrite(g_rom_image + address, sector_size, 1, delta_file);
+			fwprintf(map_file, L"%8d  %06X       %06X\n", address / sector_size, address, changed_count * sector_size);
+			changed_count++;
 		}
 	}
 
+	fclose(delta_file);
+	fclose(map_file);
+
+	PRINT_INFO(L"\nDelta output: %d of %d sectors changed (%d bytes).", changed_count, sector_count, changed_count * sector_size);
+
 	return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Copies data from the file buffer to the ROM buffer
-static void CopyDataToROM(int length, uint8_t* in_source)
+// Loads the base image of the stable layout and its directory. The ROM size, the cart type, the hardware revision
+// and the compressed mode are determined by the base image.
+static bool LoadBaseImage(void)
 {
-	int byte_count;
+	FILE* base_file = NULL;
+	long file_length;
+	unsigned const char* loader;
+	int loader_length;
+	ROMFileSystemInfo* file_system_info = NULL;
+	ROMFileInfo* file_info;
+	int directory_address;
+	int entry_count;
+	int group;
+	int i;
+	bool compressed_mode = g_compressed_mode;
+	bool success = true;
 
-	for (byte_count = 0; byte_count < length; byte_count++)
+	if (_wfopen_s(&base_file, g_base_image_file_name, L"rb") != 0 || base_file == NULL)
 	{
-		// check for page start
-		if ((g_rom_image_address % CART_PAGE_SIZE) == 0)
-		{
-			// copy page start bytes
-			switch (g_cart_type)
+		PRINT_ERROR(L"\nCan't open base image!");
+		return false;
+	}
+
+	fseek(base_file, 0, SEEK_END);
+	file_length = ftell(base_file);
+	fseek(base_file, 0, SEEK_SET);
+
+	// the base image size must be one of the ROM sizes
+	success = false;
+	for (i = 0; i < sizeof(g_cart_rom_sizes) / sizeof(g_cart_rom_sizes[0]); i++)
+	{
+		if (file_length == g_cart_rom_sizes[i])
+			success = true;
+	}
+
+	if (!success)
+		PRINT_ERROR(L"\nInvalid base image size!");
+
+	if (success)
+	{
+		g_base_image = (byte*)malloc(file_length);
+		if (g_base_image == NULL)
+		{
+			PRINT_ERROR(L"\nInsufficient memory!");
+			success = false;
+		}
+	}
+
+	if (success && fread(g_base_image, file_length, 1, base_file) != 1)
+	{
+		PRINT_ERROR(L"\nCan't read base image!");
+		success = false;
+	}
+
+	fclose(base_file);
+
+	// find the loader of the base image (megacart, multicart, with or without decompressor, hardware revision)
+	for (i = 0; i < 8 && success && file_system_info == NULL; i++)
+	{
+		g_cart_type = ((i & 1) == 0) ? CART_TYPE_MEGACART : CART_TYPE_MULTICART;
+		g_compressed_mode = ((i & 2) != 0);
+		g_hw_revision = ((i & 4) == 0) ? HW_REVISION_CURRENT : HW_REVISION_FIRST;
+
+		if (g_cart_type != CART_TYPE_MEGACART && g_hw_revision == HW_REVISION_FIRST)
+			continue;
+
+		GetLoaderBinary(&loader, &loader_length);
+		if (memcmp(g_base_image, loader, loader_length - sizeof(ROMFileSystemInfo)) == 0)
+			file_system_info = (ROMFileSystemInfo*)(g_base_image + loader_length - sizeof(ROMFileSystemInfo));
+	}
+
+	if (success && file_system_info == NULL)
+	{
+		PRINT_ERROR(L"\nThe base image was created by a different version of the image builder!");
+		success = false;
+	}
+
+	// collect the files of the 1.x and 2.x directories
+	if (success)
+	{
+		g_base_file_info = (BaseFileInfo*)malloc((file_system_info->Files1xCount + file_system_info->Files2xCount) * sizeof(BaseFileInfo));
+		if (g_base_file_info == NULL)
+		{
+			PRINT_ERROR(L"\nInsufficient memory!");
+			success = false;
+		}
+	}
+
+	for (group = 0; group < 2 && success; group++)
+	{
+		directory_address = (group == 0) ? file_system_info->Directory1xAddress : file_system_info->Directory2xAddress;
+		entry_count = (group == 0) ? file_system_info->Files1xCount : file_system_info->Files2xCount;
+
+		for (i = 0; i < entry_count && success; i++)
+		{
+			// skip name hash, name length and name
+			if (directory_address + 2 <= CART_PAGE_SIZE)
+				directory_address += 2 + g_base_image[directory_address + 1];
+
+			if (directory_address + (int)sizeof(ROMFileInfo) > CART_PAGE_SIZE)
+			{
+				PRINT_ERROR(L"\nInvalid base image directory!");
+				success = false;
+				break;
+			}
+
+			file_info = (ROMFileInfo*)(g_base_image + directory_address);
+			directory_address += sizeof(ROMFileInfo);
+
+			g_base_file_info[g_base_file_info_count].ROMAddress = file_info->Page * CART_PAGE_SIZE + file_info->Address;
+			g_base_file_info[g_base_file_info_count].Length = file_info->Length | (file_info->LengthHigh << 16);
+			g_base_file_info[g_base_file_info_count].Compressed = (file_info->Flags & ROM_FILE_FLAG_COMPRESSED) != 0;
+			g_base_file_info_count++;
+		}
+	}
+
+	if (success)
+	{
+		g_base_image_size = file_length;
+		g_cart_rom_size = file_length;
+		g_rom_size_mode = ROM_SIZE_MODE_FIXED;
+
+		// compressed mode is kept when it was forced
+		g_compressed_mode = g_compressed_mode || compressed_mode;
+
+		PRINT_INFO(L"\nBase image: %dkB, %d directory entries.", g_base_image_size / 1024, g_base_file_info_count);
+	}
+
+	return success;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Plans ROM image layout. Determines the addresses, compresses the files when needed and creates the
+// stored data stream. The planned end address of the image is stored in g_rom_image_address.
+static bool PlanROMImage(void)
+{
+	unsigned const char* loader;
+	int loader_length;
+	bool success = true;
+
+	success = GetLoaderBinary(&loader, &loader_length);
+
+	if (success)
+	{
+		// update addresses
+		g_rom_file_system_info_address = loader_length - sizeof(ROMFileSystemInfo);
+		g_rom_files_address = g_rom_file_system_info_address + sizeof(ROMFileSystemInfo) + GetROMDirectoryLength();
+
+		// the loader reads the directory from the first page
+		if (g_rom_files_address > CART_PAGE_SIZE)
+		{
+			PRINT_ERROR(L"\nToo many files, the directory doesn't fit into the first ROM page!");
+			success = false;
+		}
+	}
+
+	if (success)
+	{
+		if (g_compressed_mode)
+		{
+			// compress all files before building the file system (the compressed files are reused when the image is planned again)
+			if (!g_files_compressed)
+				success = CompressFiles();
+			else
+				SelectCompressedFiles();
+
+			g_compression_planned = false;
+
+			PRINT_INFO(L"\nBuilding Compressed ROM file system.");
+		}
+		else
+		{
+			PRINT_INFO(L"\nBuilding ROM file system.");
+		}
+	}
+
+	if (success)
+		success = PlanROMFileSystem();
+
+	// select the files to decompress using the free space
+	if (success && g_compressed_mode)
+		success = OptimizeCompressedFiles();
+
+	// determine end address of the image
+	if (success)
+	{
+		if (g_rom_stream_length > 0)
+			g_rom_image_address = GetStreamROMAddress(g_rom_stream_length - 1) + 1;
+		else
+			g_rom_image_address = g_rom_files_address;
+	}
+
+	return success;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Plans the file data of the ROM image. Creates the stored data stream (file data without page headers) and
+// determines the stream position of the files. The files are placed in the file list order or by the page
+// layout engine, when a base image is specified the files keep their base image position (stable layout).
+static bool PlanROMFileSystem(void)
+{
+	int sequential_length;
+	int sequential_crossings;
+
+	if (g_base_image != NULL)
+	{
+		if (!PlanStableLayout())
+			return false;
+
+		if (g_rom_stream_length <= GetStreamCapacity())
+			return true;
+
+		PRINT_INFO(L"\nThe files don't fit into the ROM using the stable layout, all files are placed again.");
+
+		// the files are not kept at their base image address, the compression plan might change their storage form
+		for (int i = 0; i < g_file_info_count; i++)
+			g_file_info[i].BaseFileKept = false;
+	}
+
+	PlanSequentialLayout();
+
+	if (g_page_layout_enabled && g_rom_stream_length <= GetStreamCapacity())
+	{
+		sequential_length = g_rom_stream_length;
+		sequential_crossings = CountPageCrossings();
+
+		if (!PlanPageLayout())
+			return false;
+
+		// use the file list order when the page layout doesn't fit
+		if (g_rom_stream_length > GetStreamCapacity())
+			PlanSequentialLayout();
+		else
+			PRINT_INFO(L"\nPage layout: %d page boundary crossings (%d in file list order), %d bytes used for alignment.", CountPageCrossings(), sequential_crossings, g_rom_stream_length - sequential_length);
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Places the file data into the stream in the file list order
+static void PlanSequentialLayout(void)
+{
+	int j;
+	int shared_length;
+	int shared_file_count = 0;
+	int shared_byte_count = 0;
+
+	g_rom_stream_length = 0;
+
+	for (int i = 0; i < g_file_info_count; i++)
+	{
+		// check if file is already in the ROM image
+		j = g_file_info[i].DuplicateFileIndex;
+
+		if (j >= 0)
+		{
+			// file already included in the image, copy only the position
+			g_file_info[i].StreamPos = g_file_info[j].StreamPos;
+			g_file_info[i].Compressed = g_file_info[j].Compressed;
+		}
+		else
+		{
+			shared_length = AppendFileToStream(&g_file_info[i], 0);
+
+			if (shared_length > 0)
+			{
+				shared_file_count++;
+				shared_byte_count += shared_length;
+			}
+		}
+	}
+
+	if (shared_file_count > 0)
+		PRINT_INFO(L"\n%d files share content with other files, %d bytes saved.", shared_file_count, shared_byte_count);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Places the file data into the stream minimizing the number of files crossing page boundaries. The pages are
+// filled one by one, the file with the highest load weight (and the largest size) which fits into the rest of
+// the page is placed next. Files longer than a page are placed where they don't cross more page boundaries than
+// required. When no file fits, the rest of the page is skipped as long as the free space of the ROM allows it,
+// otherwise a file is placed across the page boundary (long files first, then the least frequently loaded ones).
+// Stored files contained by another file (found by the sequential layout) keep sharing its content.
+static bool PlanPageLayout(void)
+{
+	int* container;
+	int* container_offset;
+	int* weight;
+	int* length;
+	bool* placed;
+	int page_data_length = CART_PAGE_SIZE - GetPageHeaderSize();
+	int remaining_count = 0;
+	int total_length = 0;
+	int alignment_budget;
+	int page_room;
+	int file_start;
+	int best;
+	int i, j;
+
+	container = (int*)malloc(g_file_info_count * sizeof(int));
+	container_offset = (int*)malloc(g_file_info_count * sizeof(int));
+	weight = (int*)malloc(g_file_info_count * sizeof(int));
+	length = (int*)malloc(g_file_info_count * sizeof(int));
+	placed = (bool*)malloc(g_file_info_count * sizeof(bool));
+	if (container == NULL || container_offset == NULL || weight == NULL || length == NULL || placed == NULL)
+	{
+		PRINT_ERROR(L"\nInsufficient memory!");
+		free(container);
+		free(container_offset);
+		free(weight);
+		free(length);
+		free(placed);
+		return false;
+	}
+
+	// collect the files to place
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		container[i] = -1;
+		placed[i] = true;
+
+		if (g_file_info[i].DuplicateFileIndex >= 0)
+			continue;
+
+		length[i] = GetStoredLength(&g_file_info[i]);
+
+		// find the longest stored file containing the content of the stored file (the compressed data is split into
+		// segments depending on its position, its content changes when it is placed elsewhere)
+		if (!g_file_info[i].Compressed)
+		{
+			for (j = 0; j < g_file_info_count; j++)
+			{
+				if (j != i && g_file_info[j].DuplicateFileIndex < 0 && (!g_compressed_mode || !g_file_info[j].Compressed) && g_file_info[j].StreamPos <= g_file_info[i].StreamPos &&
+					g_file_info[i].StreamPos + length[i] <= g_file_info[j].StreamPos + GetStoredLength(&g_file_info[j]) &&
+					(container[i] < 0 || GetStoredLength(&g_file_info[j]) > GetStoredLength(&g_file_info[container[i]])))
+				{
+					container[i] = j;
+				}
+			}
+		}
+
+		if (container[i] >= 0)
+		{
+			container_offset[i] = g_file_info[i].StreamPos - g_file_info[container[i]].StreamPos;
+			continue;
+		}
+
+		weight[i] = GetContentLoadWeight(i);
+		placed[i] = false;
+		remaining_count++;
+		total_length += length[i];
+	}
+
+	alignment_budget = GetStreamCapacity() - total_length;
+
+	g_rom_stream_length = 0;
+
+	while (remaining_count > 0)
+	{
+		page_room = GetStreamPageEnd(g_rom_stream_length) - g_rom_stream_length;
+
+		// the most frequently loaded file which fits into the page
+		best = -1;
+		for (i = 0; i < g_file_info_count; i++)
+		{
+			if (!placed[i] && length[i] <= page_room &&
+				(best < 0 || weight[i] > weight[best] || (weight[i] == weight[best] && length[i] > length[best])))
+			{
+				best = i;
+			}
+		}
+
+		// long file which doesn't cross more page boundaries starting here than starting at the next page
+		if (best < 0)
+		{
+			for (i = 0; i < g_file_info_count; i++)
+			{
+				if (!placed[i] && length[i] > page_data_length &&
+					CountStreamPages(g_rom_stream_length, length[i]) <= CountStreamPages(g_rom_stream_length + page_room, length[i]))
+				{
+					best = i;
+					break;
+				}
+			}
+		}
+
+		// skip the rest of the page if the free space allows it
+		if (best < 0 && page_room <= alignment_budget)
+		{
+			AppendPaddingToStream(page_room);
+			alignment_budget -= page_room;
+			continue;
+		}
+
+		// place a file across the page boundary: long files first, then the least frequently loaded ones
+		if (best < 0)
+		{
+			for (i = 0; i < g_file_info_count; i++)
+			{
+				if (!placed[i] && (best < 0 ||
+					(length[i] > page_data_length && length[best] <= page_data_length) ||
+					((length[i] > page_data_length) == (length[best] > page_data_length) && weight[i] < weight[best])))
+				{
+					best = i;
+				}
+			}
+		}
+
+		file_start = g_rom_stream_length;
+		AppendFileToStream(&g_file_info[best], GetStreamPageStart(g_rom_stream_length));
+		placed[best] = true;
+		remaining_count--;
+
+		// the stored data might be longer than planned (compressed data segments) or shorter (shared content)
+		alignment_budget -= g_rom_stream_length - file_start - length[best];
+	}
+
+	// update the position of the contained and duplicated files
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		if (container[i] >= 0)
+			g_file_info[i].StreamPos = g_file_info[container[i]].StreamPos + container_offset[i];
+	}
+
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		j = g_file_info[i].DuplicateFileIndex;
+		if (j >= 0)
+			g_file_info[i].StreamPos = g_file_info[j].StreamPos;
+	}
+
+	free(container);
+	free(container_offset);
+	free(weight);
+	free(length);
+	free(placed);
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Places the file data into the stream keeping the ROM address of the files which are unchanged since the base
+// image. The new and changed files are placed into the free space between the kept files (longest files first)
+// and the files which don't fit into the free space are appended after the last kept file.
+static bool PlanStableLayout(void)
+{
+	uint8_t* base_stream;
+	uint8_t* kept_stream;
+	int* kept_pos;
+	int* kept_length;
+	int* order;
+	int* gap_start;
+	int* gap_end;
+	int base_stream_length = GetStreamCapacity() + 1;
+	int order_count = 0;
+	int gap_count = 0;
+	int kept_count = 0;
+	int filled_count = 0;
+	int appended_count = 0;
+	int kept_end;
+	int restore_end;
+	int pos;
+	int i, j, k;
+
+	base_stream = (uint8_t*)malloc(base_stream_length);
+	kept_stream = (uint8_t*)malloc(base_stream_length);
+	kept_pos = (int*)malloc(g_file_info_count * sizeof(int));
+	kept_length = (int*)malloc(g_file_info_count * sizeof(int));
+	order = (int*)malloc(g_file_info_count * sizeof(int));
+	gap_start = (int*)malloc((g_file_info_count + 1) * sizeof(int));
+	gap_end = (int*)malloc((g_file_info_count + 1) * sizeof(int));
+	if (base_stream == NULL || kept_stream == NULL || kept_pos == NULL || kept_length == NULL || order == NULL || gap_start == NULL || gap_end == NULL)
+	{
+		PRINT_ERROR(L"\nInsufficient memory!");
+		free(base_stream);
+		free(kept_stream);
+		free(kept_pos);
+		free(kept_length);
+		free(order);
+		free(gap_start);
+		free(gap_end);
+		return false;
+	}
+
+	// file data area of the base image using the current stream layout (files address and page headers)
+	for (pos = 0; pos < base_stream_length; pos = GetStreamPageEnd(pos))
+	{
+		k = GetStreamPageEnd(pos);
+		if (k > base_stream_length)
+			k = base_stream_length;
+
+		memcpy(base_stream + pos, g_base_image + GetStreamROMAddress(pos), k - pos);
+	}
+
+	// find the unchanged files and sort them by their position
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		kept_pos[i] = -1;
+
+		if (g_file_info[i].DuplicateFileIndex >= 0)
+			continue;
+
+		kept_pos[i] = FindBaseFile(&g_file_info[i], base_stream, base_stream_length, &kept_length[i]);
+		g_file_info[i].BaseFileKept = (kept_pos[i] >= 0);
+		if (kept_pos[i] < 0)
+			continue;
+
+		for (j = order_count; j > 0 && kept_pos[order[j - 1]] > kept_pos[i]; j--)
+			order[j] = order[j - 1];
+
+		order[j] = i;
+		order_count++;
+	}
+
+	// place the unchanged files (copy of the base image data), the free space between them is recorded as gaps
+	g_rom_stream_length = 0;
+
+	for (k = 0; k < order_count; k++)
+	{
+		i = order[k];
+		pos = kept_pos[i];
+
+		if (pos > g_rom_stream_length)
+		{
+			gap_start[gap_count] = g_rom_stream_length;
+			gap_end[gap_count] = pos;
+			gap_count++;
+
+			AppendPaddingToStream(pos - g_rom_stream_length);
+		}
+
+		// the kept files might share content
+		memcpy(g_rom_stream + pos, base_stream + pos, kept_length[i]);
+
+		if (pos + kept_length[i] > g_rom_stream_length)
+			g_rom_stream_length = pos + kept_length[i];
+
+		g_file_info[i].StreamPos = pos;
+		kept_count++;
+	}
+
+	kept_end = g_rom_stream_length;
+	memcpy(kept_stream, g_rom_stream, kept_end);
+
+	// changed files sorted by their length (longest first)
+	order_count = 0;
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		if (g_file_info[i].DuplicateFileIndex >= 0 || kept_pos[i] >= 0)
+			continue;
+
+		for (j = order_count; j > 0 && GetStoredLength(&g_file_info[order[j - 1]]) < GetStoredLength(&g_file_info[i]); j--)
+			order[j] = order[j - 1];
+
+		order[j] = i;
+		order_count++;
+	}
+
+	// fill the gaps with the changed files
+	for (j = 0; j < gap_count; j++)
+	{
+		pos = gap_start[j];
+
+		for (k = 0; k < order_count; k++)
+		{
+			i = order[k];
+			if (i < 0 || GetStoredLength(&g_file_info[i]) > gap_end[j] - pos)
+				continue;
+
+			g_rom_stream_length = pos;
+			AppendFileToStream(&g_file_info[i], pos);
+
+			if (g_rom_stream_length <= gap_end[j])
+			{
+				pos = g_rom_stream_length;
+				order[k] = -1;
+				filled_count++;
+			}
+			else
+			{
+				// restore the kept data overwritten by the file
+				restore_end = (g_rom_stream_length < kept_end) ? g_rom_stream_length : kept_end;
+				memcpy(g_rom_stream + gap_end[j], kept_stream + gap_end[j], restore_end - gap_end[j]);
+			}
+		}
+
+		// rest of the gap is unused
+		memset(g_rom_stream + pos, 0xff, gap_end[j] - pos);
+	}
+
+	// append the rest of the changed files in the file list order
+	g_rom_stream_length = kept_end;
+
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		for (k = 0; k < order_count && order[k] != i; k++)
+			;
+
+		if (k < order_count)
+		{
+			AppendFileToStream(&g_file_info[i], 0);
+			appended_count++;
+		}
+	}
+
+	// duplicated files use the position of the first file
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		j = g_file_info[i].DuplicateFileIndex;
+		if (j >= 0)
+		{
+			g_file_info[i].StreamPos = g_file_info[j].StreamPos;
+			g_file_info[i].Compressed = g_file_info[j].Compressed;
+		}
+	}
+
+	free(base_stream);
+	free(kept_stream);
+	free(kept_pos);
+	free(kept_length);
+	free(order);
+	free(gap_start);
+	free(gap_end);
+
+	PRINT_INFO(L"\nStable layout: %d files kept at their base image address, %d files placed into free space, %d files appended.", kept_count, filled_count, appended_count);
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Finds the file in the base image. The file is found when the base image contains the same stored data at the
+// address of a base image file with the same length. The compressed data is created in the unused area of the
+// stream (at a position with the same distance from the page end) for the comparison. The storage form of the
+// found file is set to the form of the base file, after the compression plan is made only the base files with
+// the planned storage form are used. Returns the position of the file in the stream or -1 if the file is not found.
+static int FindBaseFile(ProgramFileInfo* inout_file_info, uint8_t* in_base_stream, int in_base_stream_length, int* out_stored_length)
+{
+	int page_data_length = CART_PAGE_SIZE - GetPageHeaderSize();
+	int stream_length = g_rom_stream_length;
+	bool compressed = inout_file_info->Compressed;
+	int compare_pos;
+	int pos;
+
+	for (int i = 0; i < g_base_file_info_count; i++)
+	{
+		pos = GetROMStreamPos(g_base_file_info[i].ROMAddress);
+
+		// the file must be in the file data area of the ROM
+		if (pos < 0 || g_base_file_info[i].Length != inout_file_info->Length)
+			continue;
+
+		if (g_base_file_info[i].Compressed)
+		{
+			if (!g_compressed_mode || inout_file_info->CompressedData == NULL || (g_compression_planned && !compressed))
+				continue;
+
+			// create compressed data after the end of the ROM
+			compare_pos = GetStreamPageStart(in_base_stream_length) + 2 * page_data_length - (GetStreamPageEnd(pos) - pos);
+
+			inout_file_info->Compressed = true;
+			g_rom_stream_length = compare_pos;
+			AppendFileToStream(inout_file_info, compare_pos);
+			*out_stored_length = g_rom_stream_length - compare_pos;
+			g_rom_stream_length = stream_length;
+
+			if (inout_file_info->StreamPos == compare_pos && pos + *out_stored_length <= in_base_stream_length &&
+				memcmp(in_base_stream + pos, g_rom_stream + compare_pos, *out_stored_length) == 0)
+			{
+				return pos;
+			}
+
+			inout_file_info->Compressed = compressed;
+		}
+		else
+		{
+			if (g_compression_planned && compressed)
+				continue;
+
+			if (pos + inout_file_info->Length <= in_base_stream_length &&
+				memcmp(in_base_stream + pos, g_file_buffer + inout_file_info->BufferPos, inout_file_info->Length) == 0)
+			{
+				inout_file_info->Compressed = false;
+				*out_stored_length = inout_file_info->Length;
+				return pos;
+			}
+		}
+	}
+
+	return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Appends file data to the stored data stream. The stored (uncompressed) files might share content with the
+// already stored data, the shared part must start at the in_min_shared_pos stream position or after it.
+// Returns the length of the shared content.
+static int AppendFileToStream(ProgramFileInfo* inout_file_info, int in_min_shared_pos)
+{
+	int length;
+	int stream_pos;
+	int shared_length;
+	uint8_t* source;
+
+	if (g_compressed_mode && inout_file_info->Compressed)
+	{
+		// the first segment of the compressed data must fit into the page after the uncompressed first bytes
+		length = IsCASFile(inout_file_info) ? 0 : CHIN_UNCOMPRESSED_BYTE_COUNT;
+		if (GetStreamPageEnd(g_rom_stream_length + length) - (g_rom_stream_length + length) < ZX7_MIN_FIRST_SEGMENT_SIZE)
+			AppendPaddingToStream(GetStreamPageEnd(g_rom_stream_length) - g_rom_stream_length);
+
+		inout_file_info->StreamPos = g_rom_stream_length;
+
+		// copy first bytes of the non CAS files (without compression)
+		AppendDataToStream(length, (uint8_t*)(g_file_buffer + inout_file_info->BufferPos));
+
+		// copy remaining bytes using compression
+		AppendCompressedDataToStream(inout_file_info->CompressedLength, inout_file_info->CompressedData, inout_file_info->Codec);
+
+		return 0;
+	}
+
+	// store mode (no compression, the file length is smaller than CHIN_BYTE_COUNT or compression doesn't reduce the size)
+	source = (uint8_t*)(g_file_buffer + inout_file_info->BufferPos);
+	length = inout_file_info->Length;
+
+	// the file content might be already in the ROM image or it might overlap the end of the stored data
+	stream_pos = FindStoredFileContent(source, length);
+
+	shared_length = g_rom_stream_length - stream_pos;
+	if (shared_length > length)
+		shared_length = length;
+
+	// overlap with the end of the stored data is allowed only after the minimum position
+	if (shared_length < length && stream_pos < in_min_shared_pos)
+	{
+		stream_pos = g_rom_stream_length;
+		shared_length = 0;
+	}
+
+	inout_file_info->StreamPos = stream_pos;
+
+	// copy remaining part of the file
+	AppendDataToStream(length - shared_length, source + shared_length);
+
+	return shared_length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Creates ROM image from the planned layout
+static bool EmitROMImage(void)
+{
+	bool success = true;
+
+	// load loader code
+	success = CreateROMLoader();
+
+	// copy stored data stream
+	if (success)
+	{
+		g_rom_image_address = g_rom_files_address;
+		CopyDataToROM(g_rom_stream_length, g_rom_stream);
+
+		for (int i = 0; i < g_file_info_count; i++)
+			g_file_info[i].ROMAddress = GetStreamROMAddress(g_file_info[i].StreamPos);
+	}
+
+	// add directory to the image
+	if (success)
+		success = CreateROMDirectory();
+
+	return success;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the loader binary for the current cart type and mode
+static bool GetLoaderBinary(unsigned const char** out_loader, int* out_loader_length)
+{
+	switch (g_cart_type)
+	{
+		case CART_TYPE_MEGACART:
+			if (g_hw_revision == HW_REVISION_FIRST)
+			{
+				if (g_compressed_mode)
+				{
+					*out_loader = megacart_hwfix_decomp_loader_bin;
+					*out_loader_length = megacart_hwfix_decomp_loader_bin_size;
+				}
+				else
+				{
+					*out_loader = megacart_hwfix_loader_bin;
+					*out_loader_length = megacart_hwfix_loader_bin_size;
+				}
+			}
+			else
+			{
+				if (g_compressed_mode)
+				{
+					*out_loader = megacart_decomp_loader_bin;
+					*out_loader_length = megacart_decomp_loader_bin_size;
+				}
+				else
+				{
+					*out_loader = megacart_loader_bin;
+					*out_loader_length = megacart_loader_bin_size;
+				}
+			}
+			break;
+
+		case CART_TYPE_MULTICART:
+			if (g_compressed_mode)
+			{
+				*out_loader = multicart_decomp_loader_bin;
+				*out_loader_length = multicart_decomp_loader_bin_size;
+			}
+			else
+			{
+				*out_loader = multicart_loader_bin;
+				*out_loader_length = multicart_loader_bin_size;
+			}
+			break;
+
+		default:
+			return false;
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Creates loader code
+static bool CreateROMLoader()
+{
+	unsigned const char* loader;
+	int loader_length;
+
+	if (!GetLoaderBinary(&loader, &loader_length))
+		return false;
+
+	// copy loader to ROM image
+	memcpy(g_rom_image, loader, loader_length);
+
+	// update ROM address
+	g_rom_image_address = loader_length;
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Creates directory on the ROM image. The entries are stored in three groups: 1.x files, entries shared by
+// the 1.x and 2.x file systems and 2.x files. The 1.x directory contains the first two groups, the 2.x
+// directory contains the last two groups.
+static bool CreateROMDirectory()
+{
+	ROMFileInfo* file_info;
+	int directory_address;
+	int entry_count = 0;
+	int shared_count = 0;
+	int group;
+	int name_length;
+	int directory_length;
+	int saved_bytes;
+	int i;
+	bool file_system_version2x = false;
+
+	ROMFileSystemInfo* file_system_info = (ROMFileSystemInfo*)(g_rom_image + g_rom_file_system_info_address);
+	file_system_info->FilesAddress = g_rom_files_address;
+	file_system_info->Files1xCount = 0;
+	file_system_info->Files2xCount = 0;
+
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		if (g_file_info[i].Version2xFile)
+			file_system_version2x = true;
+	}
+
+	// create directory entries group by group
+	directory_address = g_rom_file_system_info_address + sizeof(ROMFileSystemInfo);
+	file_system_info->Directory1xAddress = directory_address;
+	file_system_info->Directory2xAddress = directory_address;
+
+	for (group = 0; group < 3; group++)
+	{
+		if (group == 1)
+			file_system_info->Directory2xAddress = directory_address;
+
+		for (i = 0; i < g_file_info_count; i++)
+		{
+			if ((group == 0 && (g_file_info[i].Version2xFile || g_file_info[i].EntryShared)) || (group == 1 && !g_file_info[i].EntryShared) ||
+				(group == 2 && (!g_file_info[i].Version2xFile || g_file_info[i].SharedEntryIndex >= 0)))
+			{
+				continue;
+			}
+
+			// name hash, name length and name
+			name_length = GetROMFileName((char*)(g_rom_image + directory_address + 2), &g_file_info[i]);
+			g_rom_image[directory_address] = GetROMFileNameHash((char*)(g_rom_image + directory_address + 2), name_length);
+			g_rom_image[directory_address + 1] = (uint8_t)name_length;
+			directory_address += 2 + name_length;
+
+			// file information
+			g_file_info[i].DirectoryEntryAddress = directory_address;
+			file_info = (ROMFileInfo*)(g_rom_image + directory_address);
+			directory_address += sizeof(ROMFileInfo);
+
+			file_info->Address = (g_file_info[i].ROMAddress %CART_PAGE_SIZE);
+			file_info->Page = (g_file_info[i].ROMAddress / CART_PAGE_SIZE);
+			file_info->Length = (uint16_t)(g_file_info[i].Length & 0xFFFF);
+			file_info->LengthHigh = (uint8_t)(g_file_info[i].Length >> 16);
+			file_info->Flags = (g_compressed_mode && g_file_info[i].Compressed) ? ROM_FILE_FLAG_COMPRESSED : 0;
+			if (file_info->Flags != 0 && g_file_info[i].Codec == COMPRESSION_CODEC_LZB)
+				file_info->Flags |= ROM_FILE_FLAG_LZB;
+
+			if (group < 2)
+				file_system_info->Files1xCount++;
+			if (group > 0)
+				file_system_info->Files2xCount++;
+			if (group == 1)
+				shared_count++;
+
+			entry_count++;
+		}
+	}
+
+	// the 2.x files use their shared entry
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		if (g_file_info[i].SharedEntryIndex >= 0)
+			g_file_info[i].DirectoryEntryAddress = g_file_info[g_file_info[i].SharedEntryIndex].DirectoryEntryAddress;
+	}
+
+	// the first file of the file systems is started automatically
+	file_system_info->Autostart1xAddress = g_file_info[0].DirectoryEntryAddress;
+	file_system_info->Autostart2xAddress = g_file_info[0].DirectoryEntryAddress;
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		if (g_file_info[i].Version2xFile)
+		{
+			file_system_info->Autostart2xAddress = g_file_info[i].DirectoryEntryAddress;
+			break;
+		}
+	}
+
+	// 2.x ROM uses the 1.x file system when there are no 2.x files
+	if (!file_system_version2x)
+	{
+		file_system_info->Directory2xAddress = file_system_info->Directory1xAddress;
+		file_system_info->Files2xCount = file_system_info->Files1xCount;
+	}
+
+	// compare with the fixed length entries (full length name and file information for every file)
+	directory_length = directory_address - file_system_info->Directory1xAddress;
+	saved_bytes = g_file_info_count * (MAX_TVC_FILE_NAME_LENGTH + (int)sizeof(ROMFileInfo)) - directory_length;
+	PRINT_INFO(L"\nDirectory: %d entries (%d shared), %d bytes, %d bytes saved.", entry_count, shared_count, directory_length, saved_bytes);
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the length of the ROM directory (entries of the 2.x files sharing a 1.x entry are not stored)
+static int GetROMDirectoryLength(void)
+{
+	char name[MAX_TVC_FILE_NAME_LENGTH + 1];
+	int length = 0;
+
+	for (int i = 0; i < g_file_info_count; i++)
+	{
+		if (g_file_info[i].SharedEntryIndex < 0)
+			length += 2 + GetROMFileName(name, &g_file_info[i]) + sizeof(ROMFileInfo);
+	}
+
+	return length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the file name stored in the ROM directory (upper case TVC file name with extension and terminating
+// zero, the buffer must hold MAX_TVC_FILE_NAME_LENGTH + 1 characters). Returns the length of the name.
+static int GetROMFileName(char* out_name, ProgramFileInfo* in_file_info)
+{
+	wchar_t buffer[MAX_PATH_LENGTH];
+
+	GetFileNameAndExtension(buffer, MAX_PATH_LENGTH, in_file_info->Filename);
+	_wcsupr_s(buffer, MAX_PATH_LENGTH);
+	PCToTVCFilenameAndExtension(out_name, buffer);
+
+	return (int)strlen(out_name);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Calculates the hash of the file name stored in the ROM directory. The loader calculates the same hash
+// (starting with the name length, rotate left by three bits and xor with the next character) for the
+// CAS_OPEN file name.
+static uint8_t GetROMFileNameHash(char* in_name, int in_length)
+{
+	uint8_t hash = (uint8_t)in_length;
+
+	for (int i = 0; i < in_length; i++)
+		hash = (uint8_t)((hash << 3) | (hash >> 5)) ^ (uint8_t)in_name[i];
+
+	return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Finds the 2.x files with the same name and content as a 1.x file, these files share the directory entry
+// of the 1.x file.
+static void FindSharedDirectoryEntries(void)
+{
+	char name[MAX_TVC_FILE_NAME_LENGTH + 1];
+	char name_1x[MAX_TVC_FILE_NAME_LENGTH + 1];
+	int content;
+	int i, j;
+
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		g_file_info[i].SharedEntryIndex = -1;
+		g_file_info[i].EntryShared = false;
+	}
+
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		if (!g_file_info[i].Version2xFile)
+			continue;
+
+		content = (g_file_info[i].DuplicateFileIndex >= 0) ? g_file_info[i].DuplicateFileIndex : i;
+		GetROMFileName(name, &g_file_info[i]);
+
+		for (j = 0; j < g_file_info_count && !g_file_info[j].Version2xFile; j++)
+		{
+			if (g_file_info[j].EntryShared || (j != content && g_file_info[j].DuplicateFileIndex != content))
+				continue;
+
+			GetROMFileName(name_1x, &g_file_info[j]);
+			if (strcmp(name, name_1x) == 0)
+			{
+				g_file_info[i].SharedEntryIndex = j;
+				g_file_info[j].EntryShared = true;
+				break;
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Finds files with the same content. The content hash of the files is used as an index, the file content
+// is compared only when the hashes are equal.
+static bool FindDuplicateFiles(void)
+{
+	int* index;
+	int index_size = 1;
+	int index_pos;
+	int i, j;
+
+	// the index is at least twice as large as the number of files (must be power of two)
+	while (index_size < g_file_info_count * 2)
+		index_size *= 2;
+
+	index = (int*)malloc(index_size * sizeof(int));
+	if (index == NULL)
+	{
+		PRINT_ERROR(L"\nInsufficient memory!");
+		return false;
+	}
+
+	for (index_pos = 0; index_pos < index_size; index_pos++)
+		index[index_pos] = -1;
+
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		g_file_info[i].DuplicateFileIndex = -1;
+
+		// find the first file with the same content (linear probing)
+		index_pos = (int)(g_file_info[i].ContentHash.Low & (index_size - 1));
+		while ((j = index[index_pos]) >= 0)
+		{
+			if (ContentHashEquals(&g_file_info[i].ContentHash, &g_file_info[j].ContentHash) && g_file_info[j].Length == g_file_info[i].Length &&
+				memcmp(&g_file_buffer[g_file_info[i].BufferPos], &g_file_buffer[g_file_info[j].BufferPos], g_file_info[i].Length) == 0)
+			{
+				g_file_info[i].DuplicateFileIndex = j;
+				break;
+			}
+
+			index_pos = (index_pos + 1) & (index_size - 1);
+		}
+
+		// add unique file to the index
+		if (g_file_info[i].DuplicateFileIndex < 0)
+			index[index_pos] = i;
+	}
+
+	free(index);
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Compresses all unique files using a pool of worker threads
+static bool CompressFiles(void)
+{
+	HANDLE* threads;
+	ZX7Workspace* workspaces;
+	int thread_count;
+	int started_thread_count;
+	int unique_file_count = 0;
+	int cached_file_count = 0;
+	size_t buffer_size = 0;
+	int uncompressed_length;
+	int compressed_length;
+	int stored_file_count;
+	int i;
+
+	// count files to compress and determine compressed data buffer size
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		if (g_file_info[i].DuplicateFileIndex < 0)
+		{
+			unique_file_count++;
+			buffer_size += GetCompressedDataBound(g_file_info[i].Length);
+			if (IsCASFile(&g_file_info[i]))
+				buffer_size += LZBCompressBound(g_file_info[i].Length);
+		}
+	}
+
+	g_compressed_data = (uint8_t*)malloc(buffer_size);
+	if (g_compressed_data == NULL)
+	{
+		PRINT_ERROR(L"\nInsufficient memory!");
+		return false;
+	}
+
+	g_compressed_data_length = 0;
+
+	// reuse compressed files from the cache
+	if (g_compression_cache_file_name[0] != '\0')
+	{
+		if (!CompressionCacheLoad(g_compression_cache_file_name, g_compression_cache_size))
+			PRINT_INFO(L"\nInvalid compression cache file, it will be rebuilt.");
+
+		for (i = 0; i < g_file_info_count; i++)
+		{
+			if (g_file_info[i].DuplicateFileIndex < 0 && LoadCompressedFileFromCache(&g_file_info[i]))
+				cached_file_count++;
+		}
+	}
+
+	thread_count = g_thread_count;
+	if (thread_count > unique_file_count - cached_file_count)
+		thread_count = unique_file_count - cached_file_count;
+	if (thread_count < 1)
+		thread_count = 1;
+
+	PRINT_INFO(L"\nCompressing %d files using %d thread(s).", unique_file_count - cached_file_count, thread_count);
+
+	// one compressor workspace for each thread, reused for all files compressed by the thread
+	workspaces = (ZX7Workspace*)malloc(thread_count * sizeof(ZX7Workspace));
+	threads = (HANDLE*)malloc(thread_count * sizeof(HANDLE));
+	if (workspaces == NULL || threads == NULL)
+	{
+		PRINT_ERROR(L"\nInsufficient memory!");
+		free(workspaces);
+		free(threads);
+		CompressionCacheFree();
+
+		// the cached data is already copied into the compressed data buffer
+		for (i = 0; i < g_file_info_count; i++)
+			memset(g_file_info[i].CodecData, 0, sizeof(g_file_info[i].CodecData));
+
+		free(g_compressed_data);
+		g_compressed_data = NULL;
+
+		return false;
+	}
+
+	for (i = 0; i < thread_count; i++)
+		ZX7WorkspaceInit(&workspaces[i]);
+
+	g_next_file_to_compress = 0;
+
+	// start worker threads, the main thread is the first worker
+	started_thread_count = 0;
+	for (i = 1; i < thread_count; i++)
+	{
+		threads[started_thread_count] = CreateThread(NULL, 0, CompressionWorkerThread, &workspaces[i], 0, NULL);
+		if (threads[started_thread_count] != NULL)
+			started_thread_count++;
+	}
+
+	CompressionWorkerThread(&workspaces[0]);
+
+	// wait for the other workers
+	if (started_thread_count > 0)
+		WaitForMultipleObjects(started_thread_count, threads, TRUE, INFINITE);
+
+	for (i = 0; i < started_thread_count; i++)
+		CloseHandle(threads[i]);
+
+	for (i = 0; i < thread_count; i++)
+		ZX7WorkspaceFree(&workspaces[i]);
+
+	free(threads);
+	free(workspaces);
+
+	// update compression cache
+	if (g_compression_cache_file_name[0] != '\0')
+		StoreCompressedFilesInCache();
+
+	SelectFileCodecs();
+
+	stored_file_count = SelectCompressedFiles();
+	if (stored_file_count > 0)
+		PRINT_INFO(L"\n%d files are stored without compression (compression doesn't reduce their size).", stored_file_count);
+
+	// display compression ratio
+	uncompressed_length = 0;
+	compressed_length = 0;
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		if (g_file_info[i].Compressed && g_file_info[i].DuplicateFileIndex < 0)
+		{
+			uncompressed_length += g_file_info[i].Length;
+			compressed_length += g_file_info[i].CompressedLength;
+			if (!IsCASFile(&g_file_info[i]))
+				uncompressed_length -= CHIN_UNCOMPRESSED_BYTE_COUNT;
+		}
+	}
+
+	if (uncompressed_length > 0)
+		PRINT_INFO(L"\nCompressed %d bytes to %d bytes (%d.%d%%) using %s parser.", uncompressed_length, compressed_length, (int)(compressed_length * 1000LL / uncompressed_length) / 10, (int)(compressed_length * 1000LL / uncompressed_length) % 10, g_compression_level_names[g_compression_level]);
+
+	PrintCodecComparison();
+
+	g_files_compressed = true;
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Compression worker thread, compresses files until all files are processed. The parameter is the workspace of the thread.
+static DWORD WINAPI CompressionWorkerThread(LPVOID in_parameter)
+{
+	ZX7Workspace* workspace = (ZX7Workspace*)in_parameter;
+	int file_index;
+
+	while ((file_index = InterlockedIncrement(&g_next_file_to_compress) - 1) < g_file_info_count)
+	{
+		if (g_file_info[file_index].DuplicateFileIndex < 0 && !g_file_info[file_index].CompressionCached)
+			CompressProgramFile(&g_file_info[file_index], workspace);
+	}
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Compresses one file. Files shorter than CHIN_UNCOMPRESSED_BYTE_COUNT are stored without compression. The
+// compressed data of the chunks (see GetCompressionChunkSize) follow each other, each one is closed by an end marker.
+// The CAS files are compressed by both codecs (the codec is selected later), the codecs loaded from the
+// compression cache are skipped.
+static void CompressProgramFile(ProgramFileInfo* inout_file_info, ZX7Workspace* in_workspace)
+{
+	uint8_t* source;
+	size_t length;
+	size_t compressed_size;
+	int range_start;
+	int range_length;
+	int chunk_size;
+	int codec;
+	ZX7Encoder encoder;
+
+	for (codec = 0; codec < COMPRESSION_CODEC_COUNT; codec++)
+	{
+		if (!inout_file_info->CodecCached[codec])
+		{
+			inout_file_info->CodecData[codec] = NULL;
+			inout_file_info->CodecLength[codec] = 0;
+		}
+	}
+
+	if (!GetCompressedRange(inout_file_info, &range_start, &range_length))
+		return;
+
+	source = g_file_buffer + inout_file_info->BufferPos + range_start;
+
+	// LZB compression (the worst case space is reserved in the compressed data buffer)
+	if (IsCASFile(inout_file_info) && !inout_file_info->CodecCached[COMPRESSION_CODEC_LZB])
+	{
+		inout_file_info->CodecData[COMPRESSION_CODEC_LZB] = g_compressed_data + InterlockedExchangeAdd(&g_compressed_data_length, (LONG)LZBCompressBound(range_length));
+		inout_file_info->CodecLength[COMPRESSION_CODEC_LZB] = LZBCompress(inout_file_info->CodecData[COMPRESSION_CODEC_LZB], source, range_length, g_lzb_search_depths[g_compression_level]);
+		if (inout_file_info->CodecLength[COMPRESSION_CODEC_LZB] == 0)
+			inout_file_info->CodecData[COMPRESSION_CODEC_LZB] = NULL;
+	}
+
+	if (inout_file_info->CodecCached[COMPRESSION_CODEC_ZX7])
+		return;
+
+	// reserve space in the compressed data buffer for the worst case
+	inout_file_info->CodecData[COMPRESSION_CODEC_ZX7] = g_compressed_data + InterlockedExchangeAdd(&g_compressed_data_length, (LONG)GetCompressedDataBound(range_length));
+
+	// the chunks end at the file positions which are multiples of the chunk size (and at the end of the file)
+	chunk_size = GetCompressionChunkSize(inout_file_info);
+	length = (chunk_size == 0) ? range_length : chunk_size - range_start % chunk_size;
+
+	while (range_length > 0)
+	{
+		if (length > (size_t)range_length)
+			length = range_length;
+
+		switch (g_compression_level)
+		{
+			case ZX7_LEVEL_GREEDY:
+				ZX7FastParse(in_workspace, source, length, 0, GetCompressionMaxOffset(inout_file_info));
+				break;
+
+			case ZX7_LEVEL_LAZY:
+				ZX7FastParse(in_workspace, source, length, 1, GetCompressionMaxOffset(inout_file_info));
+				break;
+
+			default:
+				ZX7Optimize(in_workspace, source, length, GetCompressionMaxOffset(inout_file_info));
+				break;
+		}
+
+		compressed_size = ZX7CompressedSize(in_workspace, length);
+
+		ZX7EncoderInit(&encoder, inout_file_info->CodecData[COMPRESSION_CODEC_ZX7] + inout_file_info->CodecLength[COMPRESSION_CODEC_ZX7], compressed_size);
+		inout_file_info->CodecLength[COMPRESSION_CODEC_ZX7] += (int)ZX7CompressToBuffer(&encoder, in_workspace, source, length);
+
+		source += length;
+		range_length -= (int)length;
+		length = chunk_size;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Selects the compressed data of the codec of each file. The duplicated files use the codec of the first file
+// with the same content, ZX7 is used when the file can't be compressed by the selected codec.
+static void SelectFileCodecs(void)
+{
+	int i, j;
+
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		j = g_file_info[i].DuplicateFileIndex;
+		if (j >= 0)
+		{
+			g_file_info[i].Codec = g_file_info[j].Codec;
+			continue;
+		}
+
+		g_file_info[i].Codec = GetFileCodec(&g_file_info[i]);
+		if (g_file_info[i].CodecData[g_file_info[i].Codec] == NULL)
+			g_file_info[i].Codec = COMPRESSION_CODEC_ZX7;
+
+		g_file_info[i].CompressedData = g_file_info[i].CodecData[g_file_info[i].Codec];
+		g_file_info[i].CompressedLength = g_file_info[i].CodecLength[g_file_info[i].Codec];
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Displays the compressed length and the estimated decompression time of the CAS files using each codec
+static void PrintCodecComparison(void)
+{
+	wchar_t display_filename[MAX_PATH_LENGTH];
+	int64_t total_time[COMPRESSION_CODEC_COUNT] = { 0 };
+	int total_length[COMPRESSION_CODEC_COUNT] = { 0 };
+	int uncompressed_length = 0;
+	int length;
+	int time;
+	int codec;
+	int i;
+
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		if (g_file_info[i].DuplicateFileIndex >= 0 || g_file_info[i].CodecData[COMPRESSION_CODEC_ZX7] == NULL || g_file_info[i].CodecData[COMPRESSION_CODEC_LZB] == NULL)
+			continue;
+
+		if (uncompressed_length == 0)
+			PRINT_INFO(L"\nCodec comparison of the CAS files (compressed size, ratio, estimated decompression time):");
+
+		GetFileNameAndExtension(display_filename, MAX_PATH_LENGTH, g_file_info[i].Filename);
+		PRINT_INFO(L"\n %-16s %6d bytes", display_filename, g_file_info[i].Length);
+
+		for (codec = 0; codec < COMPRESSION_CODEC_COUNT; codec++)
+		{
+			length = g_file_info[i].CodecLength[codec];
+			time = EstimateDecompressionTime(g_file_info[i].CodecData[codec], length, codec);
+
+			PRINT_INFO(L"  %s%s %6d bytes %3d.%d%% %5d ms", g_compression_codec_names[codec], (codec == g_file_info[i].Codec) ? L"*" : L" ", length, (int)(length * 1000LL / g_file_info[i].Length) / 10, (int)(length * 1000LL / g_file_info[i].Length) % 10, (int)(time * 1000LL / TVC_CPU_CLOCK));
+
+			total_length[codec] += length;
+			total_time[codec] += time;
+		}
+
+		uncompressed_length += g_file_info[i].Length;
+	}
+
+	if (uncompressed_length == 0)
+		return;
+
+	for (codec = 0; codec < COMPRESSION_CODEC_COUNT; codec++)
+	{
+		PRINT_INFO(L"\n%s: %d bytes (%d.%d%%), %lld T-states (%d ms) decompression time.", g_compression_codec_names[codec], total_length[codec], (int)(total_length[codec] * 1000LL / uncompressed_length) / 10, (int)(total_length[codec] * 1000LL / uncompressed_length) % 10, (long long)total_time[codec], (int)(total_time[codec] * 1000LL / TVC_CPU_CLOCK));
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Determines the compressed part of the file. Returns false if the file is stored without compression.
+static bool GetCompressedRange(ProgramFileInfo* in_file_info, int* out_start, int* out_length)
+{
+	*out_start = 0;
+	*out_length = in_file_info->Length;
+
+	// the long CAS files are read by more than one block input call, the decompressor can't continue the file
+	// (the non CAS files are decompressed chunk by chunk)
+	if (IsCASFile(in_file_info) && in_file_info->Length > MAX_BLOCK_FILE_LENGTH)
+		return false;
+
+	// the first bytes of the non CAS files are not compressed (CH_IN reads them directly)
+	if (!IsCASFile(in_file_info))
+	{
+		if (*out_length <= CHIN_UNCOMPRESSED_BYTE_COUNT)
+			return false;
+
+		*out_start = CHIN_UNCOMPRESSED_BYTE_COUNT;
+		*out_length -= CHIN_UNCOMPRESSED_BYTE_COUNT;
+	}
+
+	return *out_length > 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the longest sequence offset allowed in the compressed data of the file. The non CAS files can be read
+// byte by byte (CH_IN) and the loader decompresses them in a short RAM window.
+static int GetCompressionMaxOffset(ProgramFileInfo* in_file_info)
+{
+	return IsCASFile(in_file_info) ? MAX_OFFSET : CHIN_STREAM_MAX_OFFSET;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the size of the independently compressed chunks of the file (zero if the file is compressed as one chunk).
+// The loader decompresses the whole chunks of the non CAS files directly into the buffer of the block input call
+// and the partially read chunks in the CH_IN stream window, so the file can be read by any number of calls.
+static int GetCompressionChunkSize(ProgramFileInfo* in_file_info)
+{
+	return IsCASFile(in_file_info) ? 0 : COMPRESSED_CHUNK_SIZE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the maximal length of the compressed data (at most 9 bits per byte plus the end marker of each chunk)
+static int GetCompressedDataBound(int in_length)
+{
+	return in_length + in_length / 8 + 4 * (in_length / COMPRESSED_CHUNK_SIZE + 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Selects the files to store in compressed form. A file is compressed only when the compressed data
+// (including the uncompressed first bytes) is shorter than the file, the other files are stored as they are.
+// Returns the number of files stored without compression.
+static int SelectCompressedFiles(void)
+{
+	int stored_file_count = 0;
+	int i;
+
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		g_file_info[i].Compressed = false;
+
+		if (g_file_info[i].CompressedData == NULL || g_file_info[i].DuplicateFileIndex >= 0)
+			continue;
+
+		if (IsCompressionWorthwhile(&g_file_info[i]))
+			g_file_info[i].Compressed = true;
+		else
+			stored_file_count++;
+	}
+
+	return stored_file_count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Checks if the compressed data (including the uncompressed first bytes) is shorter than the file
+static bool IsCompressionWorthwhile(ProgramFileInfo* in_file_info)
+{
+	int range_start;
+	int range_length;
+
+	if (in_file_info->CompressedData == NULL)
+		return false;
+
+	GetCompressedRange(in_file_info, &range_start, &range_length);
+
+	return range_start + in_file_info->CompressedLength < in_file_info->Length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Selects the compressed files to store without compression. The free space of the ROM is used to store the
+// files where the weighted load time gain is the highest (0-1 knapsack problem, the weight is the extra space
+// required by the uncompressed file, the value is the load time gain multiplied by the load frequency weight).
+static bool OptimizeCompressedFiles(void)
+{
+	int64_t* best_gain;
+	uint8_t* selected;
+	int64_t* gain;
+	int64_t total_time = 0;
+	int64_t optimized_time = 0;
+	int* cost;
+	int* candidates;
+	int candidate_count = 0;
+	int free_space;
+	int unit;
+	int capacity;
+	int row_size;
+	int stored_count = 0;
+	int stored_length = 0;
+	int i, j, c;
+	bool success = true;
+	wchar_t display_filename[MAX_PATH_LENGTH];
+
+	free_space = GetStreamCapacity() - g_rom_stream_length;
+
+	gain = (int64_t*)malloc(g_file_info_count * sizeof(int64_t));
+	cost = (int*)malloc(g_file_info_count * sizeof(int));
+	candidates = (int*)malloc(g_file_info_count * sizeof(int));
+	if (gain == NULL || cost == NULL || candidates == NULL)
+	{
+		PRINT_ERROR(L"\nInsufficient memory!");
+		free(gain);
+		free(cost);
+		free(candidates);
+		return false;
+	}
+
+	// collect compressed files where the uncompressed storage reduces the weighted load time (the storage form
+	// of the files kept at their base image address is fixed)
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		if (!g_file_info[i].Compressed || g_file_info[i].DuplicateFileIndex >= 0 || g_file_info[i].BaseFileKept)
+			continue;
+
+		gain[i] = (int64_t)GetContentLoadWeight(i) * (EstimateLoadTime(&g_file_info[i], true) - EstimateLoadTime(&g_file_info[i], false));
+		cost[i] = g_file_info[i].Length - GetStoredLength(&g_file_info[i]);
+
+		if (gain[i] > 0 && cost[i] <= free_space)
+			candidates[candidate_count++] = i;
+	}
+
+	// the stable layout must keep the selected storage form when the files are placed again
+	g_compression_planned = true;
+
+	if (candidate_count > 0)
+	{
+		// the free space is divided into units to limit the table size (costs are rounded up)
+		unit = (free_space + KNAPSACK_MAX_UNITS - 1) / KNAPSACK_MAX_UNITS;
+		if (unit < 1)
+			unit = 1;
+		capacity = free_space / unit;
+		row_size = (capacity + 1 + 7) / 8;
+
+		best_gain = (int64_t*)calloc(capacity + 1, sizeof(int64_t));
+		selected = (uint8_t*)calloc((size_t)candidate_count * row_size, 1);
+		if (best_gain == NULL || selected == NULL)
+		{
+			PRINT_ERROR(L"\nInsufficient memory!");
+			success = false;
+		}
+
+		for (j = 0; j < candidate_count && success; j++)
+		{
+			i = candidates[j];
+			cost[i] = (cost[i] + unit - 1) / unit;
+
+			for (c = capacity; c >= cost[i]; c--)
+			{
+				if (best_gain[c - cost[i]] + gain[i] > best_gain[c])
+				{
+					best_gain[c] = best_gain[c - cost[i]] + gain[i];
+					selected[j * row_size + c / 8] |= (1 << (c % 8));
+				}
+			}
+		}
+
+		// store the selected files without compression
+		c = capacity;
+		for (j = candidate_count - 1; j >= 0 && success; j--)
+		{
+			if ((selected[j * row_size + c / 8] & (1 << (c % 8))) != 0)
+			{
+				i = candidates[j];
+				g_file_info[i].Compressed = false;
+				c -= cost[i];
+			}
+		}
+
+		free(best_gain);
+		free(selected);
+
+		if (success)
+			success = PlanROMFileSystem();
+
+		// the content sharing of the stored files might be different, restore full compression if the files don't fit
+		if (success && g_rom_stream_length > GetStreamCapacity())
+		{
+			for (j = 0; j < candidate_count; j++)
+				g_file_info[candidates[j]].Compressed = true;
+
+			success = PlanROMFileSystem();
+		}
+	}
+
+	free(gain);
+	free(cost);
+	free(candidates);
+
+	if (!success)
+		return false;
+
+	// display the plan
+	PRINT_INFO(L"\nCompression plan (weight, storage, size, estimated load time):");
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		j = (g_file_info[i].DuplicateFileIndex >= 0) ? g_file_info[i].DuplicateFileIndex : i;
+
+		GetFileNameAndExtension(display_filename, MAX_PATH_LENGTH, g_file_info[i].Filename);
+		PRINT_INFO(L"\n %-16s %4d %-10s %6d bytes %6d ms", display_filename, GetLoadWeight(i), g_file_info[j].Compressed ? L"compressed" : L"stored", GetStoredLength(&g_file_info[j]), (int)(EstimateLoadTime(&g_file_info[j], g_file_info[j].Compressed) * 1000LL / TVC_CPU_CLOCK));
+
+		total_time += (int64_t)GetLoadWeight(i) * EstimateLoadTime(&g_file_info[j], IsCompressionWorthwhile(&g_file_info[j]));
+		optimized_time += (int64_t)GetLoadWeight(i) * EstimateLoadTime(&g_file_info[j], g_file_info[j].Compressed);
+
+		if (!g_file_info[j].Compressed && IsCompressionWorthwhile(&g_file_info[j]) && j == i)
+		{
+			stored_count++;
+			stored_length += g_file_info[j].Length;
+		}
+	}
+
+	if (total_time > 0)
+		PRINT_INFO(L"\n%d files (%d bytes) stored without compression, weighted load time is %d.%d%% of the fully compressed image.", stored_count, stored_length, (int)(optimized_time * 1000 / total_time) / 10, (int)(optimized_time * 1000 / total_time) % 10);
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the load frequency weight of the file
+static int GetLoadWeight(int in_file_index)
+{
+	if (g_file_info[in_file_index].LoadWeight >= 0)
+		return g_file_info[in_file_index].LoadWeight;
+
+	// first file of the 1.x or 2.x file system is the autostart file
+	if (in_file_index == 0 || g_file_info[in_file_index].Version2xFile != g_file_info[in_file_index - 1].Version2xFile)
+		return DEFAULT_AUTOSTART_LOAD_WEIGHT;
+
+	return DEFAULT_LOAD_WEIGHT;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the sum of the load frequency weights of the file and its duplicates
+static int GetContentLoadWeight(int in_file_index)
+{
+	int weight = 0;
+
+	for (int i = in_file_index; i < g_file_info_count; i++)
+	{
+		if (i == in_file_index || g_file_info[i].DuplicateFileIndex == in_file_index)
+			weight += GetLoadWeight(i);
+	}
+
+	return weight;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Estimates the load time of the file (in Z80 T-states). The compressed file load time is estimated by
+// walking the compressed data with the cycle counts of the loader's decompressor.
+static int EstimateLoadTime(ProgramFileInfo* in_file_info, bool in_compressed)
+{
+	int range_start;
+	int range_length;
+
+	if (!in_compressed || in_file_info->CompressedData == NULL || in_file_info->CompressedLength == 0)
+		return EstimateStoredLoadTime(in_file_info->Length);
+
+	GetCompressedRange(in_file_info, &range_start, &range_length);
+
+	// uncompressed first bytes and the compressed data
+	return EstimateStoredLoadTime(range_start) + EstimateDecompressionTime(in_file_info->CompressedData, in_file_info->CompressedLength, in_file_info->Codec);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Estimates the load time of stored bytes (in Z80 T-states). The loader copies the bytes by LDIR up to the page
+// end, the number of page switches is estimated from the length. The loader of the first hardware revision
+// copies the bytes of the page register address range one by one.
+static int EstimateStoredLoadTime(int in_length)
+{
+	int page_data_length = CART_PAGE_SIZE - GetPageHeaderSize();
+	int64_t time;
+
+	time = (int64_t)in_length * LOAD_TIME_STORED_BYTE + (int64_t)in_length * LOAD_TIME_STORED_PAGE / page_data_length;
+
+	if (g_hw_revision == HW_REVISION_FIRST)
+		time += (int64_t)in_length * HW_FIX_PAGE_RANGE_SIZE / page_data_length * LOAD_TIME_STORED_HW_FIX_BYTE;
+
+	return (int)time;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Estimates the decompression time of the compressed data (in Z80 T-states)
+static int EstimateDecompressionTime(uint8_t* in_data, int in_length, int in_codec)
+{
+	LoadTimeEstimator estimator;
+	int length_bits;
+	int match_length;
+	int i;
+
+	if (in_codec == COMPRESSION_CODEC_LZB)
+		return EstimateLZBDecompressionTime(in_data, in_length);
+
+	estimator.Data = in_data;
+	estimator.Length = in_length;
+	estimator.BitPos = 0;
+	estimator.BitMask = 0;
+
+	// the first literal
+	estimator.Time = LOAD_TIME_LITERAL;
+	estimator.Pos = 1;
+
+	while (estimator.Pos < estimator.Length)
+	{
+		// literal
+		if (!ReadEstimatorBit(&estimator))
+		{
+			estimator.Time += LOAD_TIME_LITERAL;
+			estimator.Pos++;
+			continue;
+		}
+
+		// match length (Elias gamma coding)
+		length_bits = 0;
+		while (!ReadEstimatorBit(&estimator) && estimator.Pos <= estimator.Length)
+			length_bits++;
+
+		// end marker, the next chunk starts with a literal
+		if (length_bits > 15)
+		{
+			if (estimator.Pos >= estimator.Length)
+				break;
+
+			estimator.BitMask = 0;
+			estimator.Time += LOAD_TIME_LITERAL;
+			estimator.Pos++;
+			continue;
+		}
+
+		match_length = 1;
+		for (i = 0; i < length_bits; i++)
+			match_length = (match_length << 1) | ReadEstimatorBit(&estimator);
+
+		estimator.Time += LOAD_TIME_MATCH + length_bits * LOAD_TIME_MATCH_LENGTH_BIT + (match_length + 1) * LOAD_TIME_MATCH_BYTE;
+
+		// offset (long offsets have 4 additional bits)
+		if (estimator.Pos < estimator.Length && (estimator.Data[estimator.Pos] & 0x80) != 0)
+		{
+			estimator.Time += LOAD_TIME_MATCH_LONG_OFFSET;
+			estimator.Pos++;
+			for (i = 0; i < 4; i++)
+				ReadEstimatorBit(&estimator);
+		}
+		else
+		{
+			estimator.Pos++;
+		}
+	}
+
+	return estimator.Time;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Estimates the decompression time of LZB compressed data (in Z80 T-states)
+static int EstimateLZBDecompressionTime(uint8_t* in_data, int in_length)
+{
+	int time = 0;
+	int pos = 0;
+	int token;
+	int length;
+
+	while (pos < in_length)
+	{
+		token = in_data[pos++];
+
+		// literals
+		length = (token >> 4) & 0x07;
+		if (length == 0x07)
+			length = ReadLZBLength(in_data, in_length, &pos, &time);
+
+		if (length > 0)
+			time += LOAD_TIME_LZB_LITERALS + length * LOAD_TIME_LZB_BYTE;
+		pos += length;
+
+		// offset (a long offset with zero high byte is the end marker)
+		if ((token & 0x80) != 0)
+		{
+			if (pos + 1 >= in_length || in_data[pos + 1] == 0)
+			{
+				time += LOAD_TIME_LZB_END_MARKER;
+				pos += 2;
+				continue;
+			}
+
+			time += LOAD_TIME_LZB_LONG_OFFSET;
+			pos++;
+		}
+		pos++;
+
+		// match
+		length = (token & 0x0F) + LZB_MIN_MATCH;
+		if (length == 0x0F + LZB_MIN_MATCH)
+			length = ReadLZBLength(in_data, in_length, &pos, &time);
+
+		time += LOAD_TIME_LZB_SEQUENCE + length * LOAD_TIME_LZB_BYTE;
+	}
+
+	return time;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads an extended length of the LZB compressed data for the load time estimation
+static int ReadLZBLength(uint8_t* in_data, int in_length, int* inout_pos, int* inout_time)
+{
+	int length;
+
+	if (*inout_pos >= in_length)
+		return 0;
+
+	*inout_time += LOAD_TIME_LZB_LENGTH;
+	length = in_data[(*inout_pos)++];
+	if (length == 0 && *inout_pos + 1 < in_length)
+	{
+		*inout_time += LOAD_TIME_LZB_LENGTH_16BIT;
+		length = in_data[*inout_pos] | (in_data[*inout_pos + 1] << 8);
+		*inout_pos += 2;
+	}
+
+	return length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads the next bit of the compressed data and updates the estimated load time
+static int ReadEstimatorBit(LoadTimeEstimator* inout_estimator)
+{
+	inout_estimator->Time += LOAD_TIME_BIT;
+	inout_estimator->BitMask >>= 1;
+
+	// load next 8 bits
+	if (inout_estimator->BitMask == 0)
+	{
+		inout_estimator->BitMask = 0x80;
+		inout_estimator->BitPos = inout_estimator->Pos++;
+		inout_estimator->Time += LOAD_TIME_BIT_REFILL;
+	}
+
+	if (inout_estimator->BitPos >= inout_estimator->Length)
+		return 1;
+
+	return (inout_estimator->Data[inout_estimator->BitPos] & inout_estimator->BitMask) != 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the length of the stored data stream which fits into the ROM
+static int GetStreamCapacity(void)
+{
+	int first_page_length = CART_PAGE_SIZE - g_rom_files_address;
+	int page_data_length = CART_PAGE_SIZE - GetPageHeaderSize();
+
+	// the end address of the image must be lower than the ROM size
+	return first_page_length + (g_cart_rom_size / CART_PAGE_SIZE - 1) * page_data_length - 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Creates compression cache key of the file compressed by the given codec
+static void GetCompressionCacheKey(ProgramFileInfo* in_file_info, int in_codec, CompressionCacheKey* out_key)
+{
+	int range_start;
+	int range_length;
+
+	GetCompressedRange(in_file_info, &range_start, &range_length);
+
+	memset(out_key, 0, sizeof(CompressionCacheKey));
+	out_key->FileHash = in_file_info->ContentHash;
+	out_key->FileLength = in_file_info->Length;
+	out_key->RangeStart = range_start;
+	out_key->RangeLength = range_length;
+	out_key->Codec = (uint8_t)in_codec;
+	out_key->EncoderVersion = (in_codec == COMPRESSION_CODEC_LZB) ? LZB_ENCODER_VERSION : ZX7_ENCODER_VERSION;
+	out_key->CompressionLevel = (uint8_t)g_compression_level;
+	out_key->MaxOffset = (uint16_t)GetCompressionMaxOffset(in_file_info);
+	out_key->ChunkSize = (uint16_t)GetCompressionChunkSize(in_file_info);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Copies compressed file content of the used codecs from the compression cache. Returns false if any codec of
+// the file is not in the cache (only the missing codecs are compressed).
+static bool LoadCompressedFileFromCache(ProgramFileInfo* inout_file_info)
+{
+	CompressionCacheKey key;
+	uint8_t* data;
+	int length;
+	int codec_count;
+	int range_start;
+	int range_length;
+	int codec;
+
+	for (codec = 0; codec < COMPRESSION_CODEC_COUNT; codec++)
+	{
+		inout_file_info->CodecData[codec] = NULL;
+		inout_file_info->CodecLength[codec] = 0;
+		inout_file_info->CodecCached[codec] = false;
+	}
+
+	inout_file_info->CompressionCached = false;
+
+	if (!GetCompressedRange(inout_file_info, &range_start, &range_length))
+		return false;
+
+	// only the CAS files are compressed by LZB
+	codec_count = IsCASFile(inout_file_info) ? COMPRESSION_CODEC_COUNT : 1;
+
+	inout_file_info->CompressionCached = true;
+
+	for (codec = 0; codec < codec_count; codec++)
+	{
+		// the data must fit into the space reserved for the codec in the compressed data buffer
+		GetCompressionCacheKey(inout_file_info, codec, &key);
+		if (!CompressionCacheLookup(&key, &data, &length) ||
+			length > ((codec == COMPRESSION_CODEC_LZB) ? LZBCompressBound(range_length) : GetCompressedDataBound(range_length)))
+		{
+			inout_file_info->CompressionCached = false;
+			continue;
+		}
+
+		inout_file_info->CodecData[codec] = g_compressed_data + g_compressed_data_length;
+		inout_file_info->CodecLength[codec] = length;
+		inout_file_info->CodecCached[codec] = true;
+		memcpy(inout_file_info->CodecData[codec], data, length);
+		g_compressed_data_length += length;
+	}
+
+	return inout_file_info->CompressionCached;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Adds the newly compressed file contents (codecs not loaded from the cache) to the compression cache and saves
+// the cache file
+static void StoreCompressedFilesInCache(void)
+{
+	CompressionCacheKey key;
+	CompressionCacheStatistics statistics;
+	int codec;
+	int i;
+
+	for (i = 0; i < g_file_info_count; i++)
+	{
+		if (g_file_info[i].CompressionCached || g_file_info[i].DuplicateFileIndex >= 0)
+			continue;
+
+		for (codec = 0; codec < COMPRESSION_CODEC_COUNT; codec++)
+		{
+			if (g_file_info[i].CodecData[codec] != NULL && !g_file_info[i].CodecCached[codec])
+			{
+				GetCompressionCacheKey(&g_file_info[i], codec, &key);
+				CompressionCacheStore(&key, g_file_info[i].CodecData[codec], g_file_info[i].CodecLength[codec]);
+			}
+		}
+	}
+
+	if (!CompressionCacheSave())
+		PRINT_ERROR(L"\nCan't save compression cache file!");
+
+	CompressionCacheGetStatistics(&statistics);
+	PRINT_INFO(L"\nCompression cache: %d hits, %d misses, %d files (%dkB) stored, %d files evicted.", statistics.Hits, statistics.Misses, statistics.EntryCount, (statistics.Size + 1023) / 1024, statistics.EvictedCount);
+
+	CompressionCacheFree();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Copies data from the file buffer to the ROM buffer
+static void CopyDataToROM(int length, uint8_t* in_source)
+{
+	int byte_count;
+
+	for (byte_count = 0; byte_count < length; byte_count++)
+	{
+		// check for page start
+		if ((g_rom_image_address % CART_PAGE_SIZE) == 0)
+		{
+			// copy page start bytes
+			switch (g_cart_type)
 			{
 				case CART_TYPE_MEGACART:
 					memcpy(g_rom_image + g_rom_image_address, g_megacart_page_start_bytes, sizeof(g_megacart_page_start_bytes));
@@ -852,6 +3400,249 @@ static void CopyDataToROM(int length, uint8_t* in_source)
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Appends data to the stored data stream
+static void AppendDataToStream(int in_length, uint8_t* in_source)
+{
+	memcpy(g_rom_stream + g_rom_stream_length, in_source, in_length);
+	g_rom_stream_length += in_length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Appends unused bytes to the stored data stream
+static void AppendPaddingToStream(int in_length)
+{
+	memset(g_rom_stream + g_rom_stream_length, 0xff, in_length);
+	g_rom_stream_length += in_length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Appends compressed data to the stored data stream. The data is split into segments which don't cross
+// page boundaries, the segments after the first one start at the beginning of the next page (the loader
+// switches pages only between the segments). The next chunk follows the last segment of the previous one,
+// it starts on the next page when its first segment doesn't fit into the page.
+static void AppendCompressedDataToStream(int in_length, uint8_t* in_source, int in_codec)
+{
+	ZX7SegmentReader reader;
+	LZBSegmentReader lzb_reader;
+	size_t segment_length;
+	int pos = 0;
+
+	// LZB data is one chunk (CAS files only)
+	if (in_codec == COMPRESSION_CODEC_LZB)
+	{
+		LZBSegmentReaderInit(&lzb_reader, in_source, in_length);
+
+		segment_length = LZBEncodeSegment(&lzb_reader, g_rom_stream + g_rom_stream_length, GetStreamPageEnd(g_rom_stream_length) - g_rom_stream_length);
+		if (segment_length == 0)
+		{
+			AppendPaddingToStream(GetStreamPageEnd(g_rom_stream_length) - g_rom_stream_length);
+			segment_length = LZBEncodeSegment(&lzb_reader, g_rom_stream + g_rom_stream_length, GetStreamPageEnd(g_rom_stream_length) - g_rom_stream_length);
+		}
+		g_rom_stream_length += (int)segment_length;
+
+		while (!lzb_reader.Finished)
+		{
+			// skip the unused end of the page
+			AppendPaddingToStream(GetStreamPageEnd(g_rom_stream_length - 1) - g_rom_stream_length);
+
+			g_rom_stream_length += LZBEncodeSegment(&lzb_reader, g_rom_stream + g_rom_stream_length, GetStreamPageEnd(g_rom_stream_length) - g_rom_stream_length);
+		}
+
+		return;
+	}
+
+	while (pos < in_length)
+	{
+		ZX7SegmentReaderInit(&reader, in_source + pos, in_length - pos);
+
+		segment_length = ZX7EncodeSegment(&reader, g_rom_stream + g_rom_stream_length, GetStreamPageEnd(g_rom_stream_length) - g_rom_stream_length);
+		if (segment_length == 0)
+		{
+			AppendPaddingToStream(GetStreamPageEnd(g_rom_stream_length) - g_rom_stream_length);
+			segment_length = ZX7EncodeSegment(&reader, g_rom_stream + g_rom_stream_length, GetStreamPageEnd(g_rom_stream_length) - g_rom_stream_length);
+		}
+		g_rom_stream_length += (int)segment_length;
+
+		while (!reader.finished)
+		{
+			// skip the unused end of the page
+			AppendPaddingToStream(GetStreamPageEnd(g_rom_stream_length - 1) - g_rom_stream_length);
+
+			g_rom_stream_length += (int)ZX7EncodeSegment(&reader, g_rom_stream + g_rom_stream_length, GetStreamPageEnd(g_rom_stream_length) - g_rom_stream_length);
+		}
+
+		pos += (int)reader.input_index;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the length of the file data in the stored data stream (compressed data crossing page boundaries is
+// longer because of the segment end markers and the unused end of the pages)
+static int GetStoredLength(ProgramFileInfo* in_file_info)
+{
+	int range_start;
+	int range_length;
+
+	if (!g_compressed_mode || !in_file_info->Compressed)
+		return in_file_info->Length;
+
+	GetCompressedRange(in_file_info, &range_start, &range_length);
+
+	return range_start + in_file_info->CompressedLength;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the size of the header at the start of the ROM pages
+static int GetPageHeaderSize(void)
+{
+	switch (g_cart_type)
+	{
+		case CART_TYPE_MULTICART:
+			return sizeof(g_multicart_page_start_bytes);
+
+		default:
+			return sizeof(g_megacart_page_start_bytes);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Converts position of the stored file data stream to ROM address (skips page headers)
+static int GetStreamROMAddress(int in_stream_pos)
+{
+	int first_page_length = CART_PAGE_SIZE - g_rom_files_address;
+	int page_data_length = CART_PAGE_SIZE - GetPageHeaderSize();
+
+	if (in_stream_pos < first_page_length)
+		return g_rom_files_address + in_stream_pos;
+
+	in_stream_pos -= first_page_length;
+
+	return (1 + in_stream_pos / page_data_length) * CART_PAGE_SIZE + GetPageHeaderSize() + in_stream_pos % page_data_length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Converts ROM address to position of the stored file data stream. Returns -1 if the address is not in the file
+// data area (before the file data or in a page header).
+static int GetROMStreamPos(int in_rom_address)
+{
+	int first_page_length = CART_PAGE_SIZE - g_rom_files_address;
+	int page_data_length = CART_PAGE_SIZE - GetPageHeaderSize();
+
+	if (in_rom_address < g_rom_files_address || (in_rom_address >= CART_PAGE_SIZE && in_rom_address % CART_PAGE_SIZE < GetPageHeaderSize()))
+		return -1;
+
+	if (in_rom_address < CART_PAGE_SIZE)
+		return in_rom_address - g_rom_files_address;
+
+	return first_page_length + (in_rom_address / CART_PAGE_SIZE - 1) * page_data_length + in_rom_address % CART_PAGE_SIZE - GetPageHeaderSize();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the stream position of the first byte of the page containing the stream position
+static int GetStreamPageStart(int in_stream_pos)
+{
+	int first_page_length = CART_PAGE_SIZE - g_rom_files_address;
+	int page_data_length = CART_PAGE_SIZE - GetPageHeaderSize();
+
+	if (in_stream_pos < first_page_length)
+		return 0;
+
+	return first_page_length + (in_stream_pos - first_page_length) / page_data_length * page_data_length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the stream position after the last byte of the page containing the stream position
+static int GetStreamPageEnd(int in_stream_pos)
+{
+	int first_page_length = CART_PAGE_SIZE - g_rom_files_address;
+	int page_data_length = CART_PAGE_SIZE - GetPageHeaderSize();
+
+	if (in_stream_pos < first_page_length)
+		return first_page_length;
+
+	return GetStreamPageStart(in_stream_pos) + page_data_length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the number of pages used by the data stored at the stream position
+static int CountStreamPages(int in_stream_pos, int in_length)
+{
+	if (in_length == 0)
+		return 0;
+
+	return GetStreamROMAddress(in_stream_pos + in_length - 1) / CART_PAGE_SIZE - GetStreamROMAddress(in_stream_pos) / CART_PAGE_SIZE + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Counts the page boundaries crossed by the files (page switches required to load all files once)
+static int CountPageCrossings(void)
+{
+	int count = 0;
+
+	for (int i = 0; i < g_file_info_count; i++)
+	{
+		if (g_file_info[i].DuplicateFileIndex < 0 && g_file_info[i].Length > 0)
+			count += CountStreamPages(g_file_info[i].StreamPos, GetStoredLength(&g_file_info[i])) - 1;
+	}
+
+	return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Finds file content in the already stored file data (Knuth-Morris-Pratt search). Returns the stream
+// position of the content when found, otherwise the position where the file can start overlapping its
+// beginning with the end of the stored data.
+static int FindStoredFileContent(uint8_t* in_data, int in_length)
+{
+	int* prefix_length;
+	int matched_length;
+	int pos;
+
+	if (in_length == 0)
+		return g_rom_stream_length;
+
+	prefix_length = (int*)malloc(in_length * sizeof(int));
+	if (prefix_length == NULL)
+		return g_rom_stream_length;
+
+	// length of the longest proper prefix which is also suffix for all prefixes of the data
+	prefix_length[0] = 0;
+	matched_length = 0;
+	for (pos = 1; pos < in_length; pos++)
+	{
+		while (matched_length > 0 && in_data[pos] != in_data[matched_length])
+			matched_length = prefix_length[matched_length - 1];
+
+		if (in_data[pos] == in_data[matched_length])
+			matched_length++;
+
+		prefix_length[pos] = matched_length;
+	}
+
+	// search stored data
+	matched_length = 0;
+	for (pos = 0; pos < g_rom_stream_length; pos++)
+	{
+		while (matched_length > 0 && g_rom_stream[pos] != in_data[matched_length])
+			matched_length = prefix_length[matched_length - 1];
+
+		if (g_rom_stream[pos] == in_data[matched_length])
+			matched_length++;
+
+		if (matched_length == in_length)
+		{
+			free(prefix_length);
+			return pos + 1 - in_length;
+		}
+	}
+
+	free(prefix_length);
+
+	// the end of the stored data matches with the beginning of the file
+	return g_rom_stream_length - matched_length;
+}
+
 static bool IsCASFile(ProgramFileInfo* in_file_info)
 {
 	wchar_t* dot_pos = wcsrchr(in_file_info->Filename, L'.');
@@ -862,4 +3653,14 @@ static bool IsCASFile(ProgramFileInfo* in_file_info)
 	}
 
 	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the compression codec of the file (the non CAS files are read by CH_IN which supports only ZX7)
+static int GetFileCodec(ProgramFileInfo* in_file_info)
+{
+	if (!IsCASFile(in_file_info))
+		return COMPRESSION_CODEC_ZX7;
+
+	return (in_file_info->Codec >= 0) ? in_file_info->Codec : g_compression_codec;
 }
\ No newline at end of file
@@ -28,108 +28,274 @@
 
 #include "ZX7Compress.h"
 
-unsigned char* output_data;
-size_t output_index;
-size_t bit_index;
-int bit_mask;
-
-void write_byte(int value) {
-    output_data[output_index++] = value;
+static void write_byte(ZX7Encoder *encoder, int value) {
+    encoder->output_data[encoder->output_index++] = value;
 }
 
-void write_bit(int value) {
-    if (bit_mask == 0) {
-        bit_mask = 128;
-        bit_index = output_index;
-        write_byte(0);
-    }
-    if (value > 0) {
-        output_data[bit_index] |= bit_mask;
+/* writes the lowest 'count' bits of 'value' (MSB first), filling the current bit byte at once */
+static void write_bits(ZX7Encoder *encoder, unsigned int value, int count) {
+    int bits;
+
+    while (count > 0) {
+        if (encoder->bit_count == 0) {
+            encoder->bit_count = 8;
+            encoder->bit_index = encoder->output_index;
+            write_byte(encoder, 0);
+        }
+        bits = count < encoder->bit_count ? count : encoder->bit_count;
+        count -= bits;
+        encoder->bit_count -= bits;
+        encoder->output_data[encoder->bit_index] |= ((value >> count) & ((1 << bits) - 1)) << encoder->bit_count;
     }
-    bit_mask >>= 1;
 }
 
-void write_elias_gamma(int value) {
-    int i;
+/* Elias gamma code is (n-1) zero bits followed by the n significant bits of the value */
+static void write_elias_gamma(ZX7Encoder *encoder, int value) {
+    int bits;
 
-    for (i = 2; i <= value; i <<= 1) {
-        write_bit(0);
-    }
-    while ((i >>= 1) > 0) {
-        write_bit(value & i);
-    }
+    for (bits = 1; (value >> bits) > 0; bits++)
+        ;
+    write_bits(encoder, value, 2*bits-1);
+}
+
+size_t ZX7CompressedSize(ZX7Workspace *workspace, size_t input_size) {
+    return (workspace->bits[input_size-1]+18+7)/8;
+}
+
+void ZX7EncoderInit(ZX7Encoder *encoder, unsigned char *output_buffer, size_t output_buffer_size) {
+    encoder->output_data = output_buffer;
+    encoder->output_size = output_buffer_size;
+    encoder->output_index = 0;
+    encoder->bit_index = 0;
+    encoder->bit_count = 0;
 }
 
-unsigned char *ZX7Compress(Optimal *optimal, unsigned char *input_data, size_t input_size, size_t *output_size) {
+/* returns the compressed size or zero if the output buffer is too small */
+size_t ZX7CompressToBuffer(ZX7Encoder *encoder, ZX7Workspace *workspace, unsigned char *input_data, size_t input_size) {
+    uint32_t *next = workspace->bits;
+    uint32_t *len = workspace->len;
     size_t input_index;
     size_t input_prev;
     int offset1;
-    int mask;
-    int i;
 
-    /* calculate and allocate output buffer */
-    input_index = input_size-1;
-    *output_size = (optimal[input_index].bits+18+7)/8;
-    output_data = (unsigned char *)malloc(*output_size);
-    if (!output_data) {
-         fprintf(stderr, "Error: Insufficient memory\n");
-         exit(1);
+    /* check output buffer size */
+    if (encoder->output_size < ZX7CompressedSize(workspace, input_size)) {
+        return 0;
     }
 
-    /* un-reverse optimal sequence */
-    optimal[input_index].bits = 0;
+    /* un-reverse optimal sequence (the bits array is reused for the links) */
+    input_index = input_size-1;
+    next[input_index] = 0;
     while (input_index > 0) {
-        input_prev = input_index - (optimal[input_index].len > 0 ? optimal[input_index].len : 1);
-        optimal[input_prev].bits = input_index;
+        input_prev = input_index - (len[input_index] > 0 ? len[input_index] : 1);
+        next[input_prev] = (uint32_t)input_index;
         input_index = input_prev;
     }
 
-    output_index = 0;
-    bit_mask = 0;
+    encoder->output_index = 0;
+    encoder->bit_count = 0;
 
     /* first byte is always literal */
-    write_byte(input_data[0]);
+    write_byte(encoder, input_data[0]);
 
     /* process remaining bytes */
-    while ((input_index = optimal[input_index].bits) > 0) {
-        if (optimal[input_index].len == 0) {
+    while ((input_index = next[input_index]) > 0) {
+        if (len[input_index] == 0) {
 
             /* literal indicator */
-            write_bit(0);
+            write_bits(encoder, 0, 1);
 
             /* literal value */
-            write_byte(input_data[input_index]);
+            write_byte(encoder, input_data[input_index]);
 
         } else {
 
             /* sequence indicator */
-            write_bit(1);
+            write_bits(encoder, 1, 1);
 
             /* sequence length */
-            write_elias_gamma(optimal[input_index].len-1);
+            write_elias_gamma(encoder, len[input_index]-1);
 
             /* sequence offset */
-            offset1 = optimal[input_index].offset-1;
+            offset1 = workspace->offset[input_index]-1;
             if (offset1 < 128) {
-                write_byte(offset1);
+                write_byte(encoder, offset1);
             } else {
                 offset1 -= 128;
-                write_byte((offset1 & 127) | 128);
-                for (mask = 1024; mask > 127; mask >>= 1) {
-                    write_bit(offset1 & mask);
+                write_byte(encoder, (offset1 & 127) | 128);
+                write_bits(encoder, offset1 >> 7, 4);
+            }
+        }
+    }
+
+    /* sequence indicator and end marker > MAX_LEN (16 zero bits and a one bit) */
+    write_bits(encoder, 1 << 17 | 1, 18);
+
+    return encoder->output_index;
+}
+
+/* advances the output index and the free bit count of the current bit byte as writing 'count' bits */
+static void skip_bits(size_t *output_index, int *bit_count, int count) {
+    int bits;
+
+    while (count > 0) {
+        if (*bit_count == 0) {
+            *bit_count = 8;
+            (*output_index)++;
+        }
+        bits = count < *bit_count ? count : *bit_count;
+        count -= bits;
+        *bit_count -= bits;
+    }
+}
+
+static int read_bit(ZX7SegmentReader *reader) {
+    reader->bit_mask >>= 1;
+    if (reader->bit_mask == 0) {
+        reader->bit_mask = 128;
+        reader->bit_index = reader->input_index++;
+    }
+    if (reader->bit_index >= reader->input_size) {
+        return 1;
+    }
+    return (reader->input_data[reader->bit_index] & reader->bit_mask) != 0;
+}
+
+static int read_byte(ZX7SegmentReader *reader) {
+    return reader->input_index < reader->input_size ? reader->input_data[reader->input_index++] : 0;
+}
+
+void ZX7SegmentReaderInit(ZX7SegmentReader *reader, const unsigned char *input_data, size_t input_size) {
+    reader->input_data = input_data;
+    reader->input_size = input_size;
+    reader->input_index = 0;
+    reader->bit_index = 0;
+    reader->bit_mask = 0;
+    reader->first = 1;
+    reader->finished = 0;
+}
+
+/* re-encodes the next sequences of the compressed data as a segment closed by an end marker. The first segment
+   starts with the first literal byte, the other segments start with a sequence indicator (the decoder keeps the
+   decompressed data and continues with a new bit group). Returns the segment size (at most max_size) or zero if
+   the first segment doesn't fit. The other segments need at least 3 bytes for the end marker. */
+size_t ZX7EncodeSegment(ZX7SegmentReader *reader, unsigned char *output_buffer, size_t max_size) {
+    ZX7Encoder encoder;
+    ZX7SegmentReader next;
+    size_t output_index;
+    int bit_count;
+    int literal = 0;
+    int len_bits;
+    int len;
+    int offset1 = 0;
+    int i;
+
+    ZX7EncoderInit(&encoder, output_buffer, max_size);
+
+    /* first byte is always literal */
+    if (reader->first) {
+        if (max_size < ZX7_MIN_FIRST_SEGMENT_SIZE) {
+            return 0;
+        }
+        write_byte(&encoder, read_byte(reader));
+        reader->first = 0;
+    }
+
+    for (;;) {
+        next = *reader;
+
+        if (!read_bit(&next)) {
+
+            /* literal */
+            literal = read_byte(&next);
+            len = 0;
+
+        } else {
+
+            /* sequence length (end marker has more than 15 zero bits) */
+            for (len_bits = 0; !read_bit(&next); len_bits++)
+                ;
+            if (len_bits > 15) {
+                *reader = next;
+                reader->finished = 1;
+                break;
+            }
+            len = 1;
+            for (i = 0; i < len_bits; i++) {
+                len = len << 1 | read_bit(&next);
+            }
+            len++;
+
+            /* sequence offset */
+            offset1 = read_byte(&next);
+            if (offset1 & 128) {
+                offset1 &= 127;
+                for (i = 0; i < 4; i++) {
+                    offset1 |= read_bit(&next) << (10 - i);
                 }
+                offset1 += 128;
+            }
+        }
+
+        /* check if the sequence and the end marker fit into the segment */
+        output_index = encoder.output_index;
+        bit_count = encoder.bit_count;
+        if (len == 0) {
+            skip_bits(&output_index, &bit_count, 1);
+            output_index++;
+        } else {
+            skip_bits(&output_index, &bit_count, 1);
+            for (len_bits = 1; ((len-1) >> len_bits) > 0; len_bits++)
+                ;
+            skip_bits(&output_index, &bit_count, 2*len_bits-1);
+            output_index++;
+            if (offset1 >= 128) {
+                skip_bits(&output_index, &bit_count, 4);
+            }
+        }
+        skip_bits(&output_index, &bit_count, 18);
+        if (output_index > max_size) {
+            break;
+        }
+
+        *reader = next;
+
+        if (len == 0) {
+            write_bits(&encoder, 0, 1);
+            write_byte(&encoder, literal);
+        } else {
+            write_bits(&encoder, 1, 1);
+            write_elias_gamma(&encoder, len-1);
+            if (offset1 < 128) {
+                write_byte(&encoder, offset1);
+            } else {
+                offset1 -= 128;
+                write_byte(&encoder, (offset1 & 127) | 128);
+                write_bits(&encoder, offset1 >> 7, 4);
             }
         }
     }
 
-    /* sequence indicator */
-    write_bit(1);
+    /* sequence indicator and end marker */
+    write_bits(&encoder, 1 << 17 | 1, 18);
 
-    /* end marker > MAX_LEN */
-    for (i = 0; i < 16; i++) {
-        write_bit(0);
+    return encoder.output_index;
+}
+
+unsigned char *ZX7Compress(ZX7Workspace *workspace, unsigned char *input_data, size_t input_size, size_t *output_size) {
+    ZX7Encoder encoder;
+    unsigned char *output_data;
+
+    /* calculate and allocate output buffer */
+    *output_size = ZX7CompressedSize(workspace, input_size);
+    output_data = (unsigned char *)malloc(*output_size);
+    if (!output_data) {
+         fprintf(stderr, "Error: Insufficient memory\n");
+         exit(1);
     }
-    write_bit(1);
+
+    ZX7EncoderInit(&encoder, output_data, *output_size);
+    ZX7CompressToBuffer(&encoder, workspace, input_data, input_size);
 
     return output_data;
 }
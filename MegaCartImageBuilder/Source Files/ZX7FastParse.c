@@ -0,0 +1,179 @@
+/*
+ * (c) Copyright 2012 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Fast greedy and lazy parsers for the ZX7 format (image builder addition). They produce the same
+ * workspace content as ZX7Optimize (costs, offsets and lengths at the end of each sequence), so the
+ * parse can be encoded by ZX7CompressToBuffer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ZX7Compress.h"
+
+#define GREEDY_CHAIN_LENGTH 16  /* number of hash chain entries checked for a match */
+#define LAZY_CHAIN_LENGTH   64
+
+typedef struct match_finder_t {
+    unsigned char *input_data;
+    size_t input_size;
+    size_t inserted;            /* positions below this are in the hash chains */
+    uint32_t *heads;            /* last position+1 for all two byte prefixes */
+    uint32_t *chain;            /* previous position+1 with the same prefix */
+    int chain_length;
+    int max_offset;
+} MatchFinder;
+
+/* adds all positions before 'position' to the hash chains */
+static void insert_positions(MatchFinder *finder, size_t position) {
+    int match_index;
+
+    while (finder->inserted < position) {
+        if (finder->inserted+1 < finder->input_size) {
+            match_index = finder->input_data[finder->inserted] << 8 | finder->input_data[finder->inserted+1];
+            finder->chain[finder->inserted] = finder->heads[match_index];
+            finder->heads[match_index] = (uint32_t)(finder->inserted+1);
+        }
+        finder->inserted++;
+    }
+}
+
+/* finds the longest match starting at position (the nearest one if there are several), returns its length */
+static size_t find_match(MatchFinder *finder, size_t position, int *out_offset) {
+    unsigned char *input_data = finder->input_data;
+    size_t max_len;
+    size_t best_len;
+    size_t len;
+    size_t match;
+    int chain_length;
+
+    insert_positions(finder, position);
+
+    best_len = 0;
+    *out_offset = 0;
+    if (position+1 >= finder->input_size) {
+        return 0;
+    }
+
+    max_len = finder->input_size-position;
+    if (max_len > MAX_LEN) {
+        max_len = MAX_LEN;
+    }
+
+    match = finder->heads[input_data[position] << 8 | input_data[position+1]];
+    for (chain_length = finder->chain_length; match > 0 && chain_length > 0 && best_len < max_len; chain_length--) {
+        match--;
+        if (position-match > (size_t)finder->max_offset) {
+            break;
+        }
+
+        /* the first two bytes are equal because of the hash chain */
+        if (best_len < 2 || input_data[match+best_len] == input_data[position+best_len]) {
+            len = 2;
+            while (len < max_len && input_data[match+len] == input_data[position+len]) {
+                len++;
+            }
+            if (len > best_len) {
+                best_len = len;
+                *out_offset = (int)(position-match);
+            }
+        }
+        match = finder->chain[match];
+    }
+
+    return best_len;
+}
+
+/* cost of the bytes at the end of a match of the given offset after a shorter sequence */
+static int rest_bits(int offset, int len) {
+    return (len >= 2) ? count_bits(offset, len) : len*9;
+}
+
+/* max_offset limits the sequence offsets (at most MAX_OFFSET) for decoders with a short history */
+void ZX7FastParse(ZX7Workspace *workspace, unsigned char *input_data, size_t input_size, int lazy, int max_offset) {
+    MatchFinder finder;
+    size_t position;
+    size_t len;
+    size_t next_len;
+    size_t end;
+    int offset;
+    int next_offset;
+
+    ZX7WorkspaceReserve(workspace, input_size);
+
+    finder.input_data = input_data;
+    finder.input_size = input_size;
+    finder.inserted = 0;
+    finder.heads = workspace->heads;
+    finder.chain = workspace->smaller_tree;
+    finder.chain_length = lazy ? LAZY_CHAIN_LENGTH : GREEDY_CHAIN_LENGTH;
+    finder.max_offset = max_offset;
+    memset(finder.heads, 0, 256*256*sizeof(uint32_t));
+
+    /* first byte is always literal */
+    workspace->bits[0] = 8;
+    workspace->offset[0] = 0;
+    workspace->len[0] = 0;
+
+    position = 1;
+    len = find_match(&finder, position, &offset);
+    while (position < input_size) {
+        if (len >= 2 && lazy) {
+            /* emit a literal if the literal and the match at the next byte cost less than the match here covering
+               the same bytes (the rest is covered by the tail of the next match or by literals) */
+            next_len = find_match(&finder, position+1, &next_offset);
+            if (next_len+1 > len && 9 + count_bits(next_offset, (int)next_len) < count_bits(offset, (int)len) + rest_bits(next_offset, (int)(next_len+1-len))) {
+                workspace->bits[position] = workspace->bits[position-1] + 9;
+                workspace->offset[position] = 0;
+                workspace->len[position] = 0;
+                position++;
+                len = next_len;
+                offset = next_offset;
+                continue;
+            }
+        }
+
+        if (len >= 2) {
+            /* sequence, only the last byte of the sequence holds its data */
+            end = position+len-1;
+            workspace->bits[end] = workspace->bits[position-1] + count_bits(offset, (int)len);
+            workspace->offset[end] = offset;
+            workspace->len[end] = (uint32_t)len;
+            position += len;
+        } else {
+            /* literal */
+            workspace->bits[position] = workspace->bits[position-1] + 9;
+            workspace->offset[position] = 0;
+            workspace->len[position] = 0;
+            position++;
+        }
+
+        if (position < input_size) {
+            len = find_match(&finder, position, &offset);
+        }
+    }
+}
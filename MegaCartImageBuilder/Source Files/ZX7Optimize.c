@@ -25,9 +25,22 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "ZX7Compress.h"
 
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define SIMD_MATCH_LENGTH
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#include <cpuid.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
 int elias_gamma_bits(int value) {
     int bits;
 
@@ -43,78 +56,321 @@ int count_bits(int offset, int len) {
     return 1 + (offset > 128 ? 12 : 8) + elias_gamma_bits(len-1);
 }
 
-Optimal* ZX7Optimize(unsigned char *input_data, size_t input_size) {
-    size_t *min;
-    size_t *max;
-    Match *matches;
-    Match *match_slots;
-    Optimal *optimal;
-    Match *match;
+/*
+ * Match length extension kernels. They compare the bytes backwards from input_data[i-len] and
+ * input_data[match-len] and return the length of the match, at most max_len (max_len-1 <= match).
+ */
+typedef size_t (*match_length_function)(const unsigned char *input_data, size_t i, size_t match, size_t len, size_t max_len);
+
+static size_t match_length_scalar(const unsigned char *input_data, size_t i, size_t match, size_t len, size_t max_len) {
+    while (len < max_len && input_data[i-len] == input_data[match-len]) {
+        len++;
+    }
+    return len;
+}
+
+#ifdef SIMD_MATCH_LENGTH
+/* index of the highest set bit of a non zero mask */
+static int highest_bit(unsigned int mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse(&index, mask);
+    return (int)index;
+#else
+    return 31 - __builtin_clz(mask);
+#endif
+}
+
+/* compares 16 bytes per step, the highest mismatching byte gives the match length */
+static size_t match_length_sse2(const unsigned char *input_data, size_t i, size_t match, size_t len, size_t max_len) {
+    unsigned int mask;
+
+    /* most candidates differ in the first bytes */
+    if (len+16 > max_len || input_data[i-len] != input_data[match-len] || input_data[i-len-1] != input_data[match-len-1]) {
+        return match_length_scalar(input_data, i, match, len, max_len);
+    }
+
+    while (len+16 <= max_len) {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(input_data+i-len-15)),
+                                                _mm_loadu_si128((const __m128i *)(input_data+match-len-15))));
+        mask = ~mask & 0xffff;
+        if (mask != 0) {
+            return len+15-highest_bit(mask);
+        }
+        len += 16;
+    }
+    return match_length_scalar(input_data, i, match, len, max_len);
+}
+
+/* compares 32 bytes per step */
+TARGET_AVX2 static size_t match_length_avx2(const unsigned char *input_data, size_t i, size_t match, size_t len, size_t max_len) {
+    unsigned int mask;
+
+    /* most candidates differ in the first bytes */
+    if (len+32 > max_len || input_data[i-len] != input_data[match-len] || input_data[i-len-1] != input_data[match-len-1]) {
+        return match_length_sse2(input_data, i, match, len, max_len);
+    }
+
+    while (len+32 <= max_len) {
+        mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(input_data+i-len-31)),
+                                                                    _mm256_loadu_si256((const __m256i *)(input_data+match-len-31))));
+        mask = ~mask;
+        if (mask != 0) {
+            return len+31-highest_bit(mask);
+        }
+        len += 32;
+    }
+    return match_length_sse2(input_data, i, match, len, max_len);
+}
+
+/* checks CPU and OS support of AVX2 */
+static int avx2_supported(void) {
+    int info[4];
+
+#if defined(_MSC_VER)
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return 0;
+    }
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6) {
+        return 0;
+    }
+    __cpuidex(info, 7, 0);
+#else
+    unsigned int eax, ebx, ecx, edx;
+    unsigned int xcr0_low, xcr0_high;
+
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return 0;
+    }
+    __cpuid(1, eax, ebx, ecx, edx);
+    if ((ecx & (1 << 27)) == 0) {
+        return 0;
+    }
+    __asm__ ("xgetbv" : "=a" (xcr0_low), "=d" (xcr0_high) : "c" (0));
+    if ((xcr0_low & 6) != 6) {
+        return 0;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    info[1] = (int)ebx;
+#endif
+    return (info[1] & (1 << 5)) != 0;
+}
+#endif
+
+static match_length_function match_length = NULL;
+
+/* selects the fastest match length kernel supported by the CPU */
+static void select_match_length_function(void) {
+    if (match_length != NULL) {
+        return;
+    }
+#ifdef SIMD_MATCH_LENGTH
+    match_length = avx2_supported() ? match_length_avx2 : match_length_sse2;
+#else
+    match_length = match_length_scalar;
+#endif
+}
+
+#define WORKSPACE_GRANULARITY 16384
+
+void ZX7WorkspaceInit(ZX7Workspace *workspace) {
+    memset(workspace, 0, sizeof(ZX7Workspace));
+    select_match_length_function();
+}
+
+void ZX7WorkspaceFree(ZX7Workspace *workspace) {
+    free(workspace->bits);
+    free(workspace->offset);
+    free(workspace->len);
+    free(workspace->smaller_tree);
+    free(workspace->larger_tree);
+    free(workspace->heads);
+    free(workspace->last_index);
+    free(workspace->last_len);
+    ZX7WorkspaceInit(workspace);
+}
+
+/* grows the per byte arrays of the workspace if the input doesn't fit */
+void ZX7WorkspaceReserve(ZX7Workspace *workspace, size_t input_size) {
+    size_t capacity;
+
+    if (workspace->heads == NULL) {
+        workspace->heads = (uint32_t *)malloc(256*256*sizeof(uint32_t));
+        workspace->last_index = (uint32_t *)malloc((MAX_OFFSET+1)*sizeof(uint32_t));
+        workspace->last_len = (uint32_t *)malloc((MAX_OFFSET+1)*sizeof(uint32_t));
+    }
+
+    if (input_size > workspace->capacity) {
+        capacity = (input_size+WORKSPACE_GRANULARITY-1)/WORKSPACE_GRANULARITY*WORKSPACE_GRANULARITY;
+
+        /* contents are not preserved, so there is no need for realloc */
+        free(workspace->bits);
+        free(workspace->offset);
+        free(workspace->len);
+        free(workspace->smaller_tree);
+        free(workspace->larger_tree);
+        workspace->bits = (uint32_t *)malloc(capacity*sizeof(uint32_t));
+        workspace->offset = (uint32_t *)malloc(capacity*sizeof(uint32_t));
+        workspace->len = (uint32_t *)malloc(capacity*sizeof(uint32_t));
+        workspace->smaller_tree = (uint32_t *)malloc(capacity*sizeof(uint32_t));
+        workspace->larger_tree = (uint32_t *)malloc(capacity*sizeof(uint32_t));
+        workspace->capacity = capacity;
+    }
+
+    if (!workspace->heads || !workspace->last_index || !workspace->last_len || !workspace->bits ||
+        !workspace->offset || !workspace->len || !workspace->smaller_tree || !workspace->larger_tree) {
+         fprintf(stderr, "Error: Insufficient memory\n");
+         exit(1);
+    }
+}
+
+/*
+ * Evaluates the sequences of min_len..max_len bytes at the given offset ending at position i.
+ * The cost of a sequence length only changes at the Elias gamma size boundaries and the cost of
+ * the optimal prefix never decreases with its length. Therefore it is enough to evaluate the
+ * shortest length with the lowest prefix cost within each gamma size group.
+ */
+static void evaluate_sequences(ZX7Workspace *workspace, size_t i, int offset, size_t min_len, size_t max_len) {
+    uint32_t *optimal_bits = workspace->bits;
+    size_t group_min;
+    size_t group_max;
+    size_t low;
+    size_t high;
+    size_t middle;
+    uint32_t prefix_bits;
+    uint32_t bits;
+
+    for (group_min = 2, group_max = 2; group_min <= max_len; group_min = group_max+1, group_max = group_max*2) {
+        if (group_max < min_len) {
+            continue;
+        }
+        low = group_min > min_len ? group_min : min_len;
+        high = group_max < max_len ? group_max : max_len;
+
+        /* find the shortest length with the lowest prefix cost */
+        prefix_bits = optimal_bits[i-high];
+        while (low < high) {
+            middle = (low+high)/2;
+            if (optimal_bits[i-middle] == prefix_bits) {
+                high = middle;
+            } else {
+                low = middle+1;
+            }
+        }
+
+        bits = prefix_bits + count_bits(offset, (int)low);
+        if (optimal_bits[i] > bits) {
+            optimal_bits[i] = bits;
+            workspace->offset[i] = offset;
+            workspace->len[i] = (uint32_t)low;
+        }
+    }
+}
+
+/*
+ * Matches are found using binary trees of the previous positions (one tree for each two byte prefix).
+ * The trees are ordered by the reversed strings ending at the positions (sequences are matched
+ * backwards from the current position) and the newest position is always the root. Therefore the
+ * search path visits the positions from the nearest one and the first visited position with a
+ * longer match than any previous one is the shortest offset for all of the new lengths. This gives
+ * the same optimal parse as the exhaustive search of all offsets.
+ */
+/* max_offset limits the sequence offsets (at most MAX_OFFSET) for decoders with a short history */
+void ZX7Optimize(ZX7Workspace *workspace, unsigned char *input_data, size_t input_size, int max_offset) {
+    uint32_t *smaller_tree;
+    uint32_t *larger_tree;
+    uint32_t *heads;
+    uint32_t *last_index;
+    uint32_t *last_len;
+    uint32_t *smaller;
+    uint32_t *larger;
+    size_t smaller_len;
+    size_t larger_len;
+    size_t match;
     int match_index;
     int offset;
     size_t len;
     size_t best_len;
-    size_t bits;
     size_t i;
 
-    /* allocate all data structures at once */
-    min = (size_t *)calloc(MAX_OFFSET+1, sizeof(size_t));
-    max = (size_t *)calloc(MAX_OFFSET+1, sizeof(size_t));
-    matches = (Match *)calloc(256*256, sizeof(Match));
-    match_slots = (Match *)calloc(input_size, sizeof(Match));
-    optimal = (Optimal *)calloc(input_size, sizeof(Optimal));
+    ZX7WorkspaceReserve(workspace, input_size);
+    smaller_tree = workspace->smaller_tree;
+    larger_tree = workspace->larger_tree;
+    heads = workspace->heads;
+    last_index = workspace->last_index;
+    last_len = workspace->last_len;
 
-    if (!min || !max || !matches || !match_slots || !optimal) {
-         fprintf(stderr, "Error: Insufficient memory\n");
-         exit(1);
-    }
+    /* position 0 is never a tree node, so zero marks empty links */
+    memset(heads, 0, 256*256*sizeof(uint32_t));
+    memset(last_index, 0, (MAX_OFFSET+1)*sizeof(uint32_t));
 
     /* first byte is always literal */
-    optimal[0].bits = 8;
+    workspace->bits[0] = 8;
+    workspace->offset[0] = 0;
+    workspace->len[0] = 0;
 
     /* process remaining bytes */
     for (i = 1; i < input_size; i++) {
 
-        optimal[i].bits = optimal[i-1].bits + 9;
+        workspace->bits[i] = workspace->bits[i-1] + 9;
+        workspace->offset[i] = 0;
+        workspace->len[i] = 0;
         match_index = input_data[i-1] << 8 | input_data[i];
         best_len = 1;
-        for (match = &matches[match_index]; match->next != NULL && best_len < MAX_LEN; match = match->next) {
-            offset = i - match->next->index;
-            if (offset > MAX_OFFSET) {
-                match->next = NULL;
+
+        /* insert current position as the new root while searching the tree */
+        match = heads[match_index];
+        heads[match_index] = (uint32_t)i;
+        smaller = &smaller_tree[i];
+        larger = &larger_tree[i];
+        smaller_len = 2;
+        larger_len = 2;
+
+        for (;;) {
+            offset = (int)(i - match);
+            if (match == 0 || offset > max_offset) {
+                *smaller = 0;
+                *larger = 0;
                 break;
             }
 
-            for (len = 2; len <= MAX_LEN; len++) {
-                if (len > best_len) {
-                    best_len = len;
-                    bits = optimal[i-len].bits + count_bits(offset, len);
-                    if (optimal[i].bits > bits) {
-                        optimal[i].bits = bits;
-                        optimal[i].offset = offset;
-                        optimal[i].len = len;
-                    }
-                } else if (i+1 == max[offset]+len && max[offset] != 0) {
-                    len = i-min[offset];
-                    if (len > best_len) {
-                        len = best_len;
-                    }
-                }
-                if (i < offset+len || input_data[i-len] != input_data[i-len-offset]) {
-                    break;
+            /* the match at the same offset one byte earlier gives the match length without comparing */
+            if (last_index[offset] == i-1) {
+                len = last_len[offset]+1;
+                if (len > MAX_LEN) {
+                    len = MAX_LEN;
                 }
+            } else {
+                len = match_length(input_data, i, match, smaller_len < larger_len ? smaller_len : larger_len, match < MAX_LEN ? match+1 : MAX_LEN);
             }
-            min[offset] = i+1-len;
-            max[offset] = i;
-        }
-        match_slots[i].index = i;
-        match_slots[i].next = matches[match_index].next;
-        matches[match_index].next = &match_slots[i];
-    }
+            last_index[offset] = (uint32_t)i;
+            last_len[offset] = (uint32_t)len;
 
-    /* save time by releasing the largest block only, the O.S. will clean everything else later */
-    free(match_slots);
+            if (len > best_len) {
+                evaluate_sequences(workspace, i, offset, best_len+1, len);
+                best_len = len;
+            }
 
-    return optimal;
-}
+            if (len >= MAX_LEN) {
+                /* current position replaces the matching node */
+                *smaller = smaller_tree[match];
+                *larger = larger_tree[match];
+                break;
+            }
 
+            if (len > match || input_data[match-len] < input_data[i-len]) {
+                *smaller = (uint32_t)match;
+                smaller = &larger_tree[match];
+                match = *smaller;
+                smaller_len = len;
+            } else {
+                *larger = (uint32_t)match;
+                larger = &smaller_tree[match];
+                match = *larger;
+                larger_len = len;
+            }
+        }
+    }
+}
@@ -1,75 +1,130 @@
 /* Generated by bin2c, do not edit manually */
 
 /* Contents of file megacart_decomp_loader.bin */
-const long int megacart_decomp_loader_bin_size = 1103;
-const unsigned char megacart_decomp_loader_bin[1103] = {
+const long int megacart_decomp_loader_bin_size = 1975;
+const unsigned char megacart_decomp_loader_bin[1975] = {
     0x4D, 0x4F, 0x50, 0x53, 0xAF, 0x32, 0x00, 0xFC, 0xC3, 0x15, 0xC0, 0x4D, 0x45, 0x47, 0x41, 0x43,
-    0x41, 0x52, 0x54, 0x00, 0x03, 0x3E, 0x30, 0x32, 0x03, 0x00, 0xD3, 0x02, 0xD5, 0x21, 0x16, 0xC3,
-    0x11, 0x05, 0x0C, 0x01, 0x09, 0x01, 0xED, 0xB0, 0xCD, 0x1D, 0x0C, 0xD1, 0x21, 0xEA, 0xFF, 0x19,
+    0x41, 0x52, 0x54, 0x00, 0x03, 0x3E, 0x30, 0x32, 0x03, 0x00, 0xD3, 0x02, 0xD5, 0x21, 0xD8, 0xC5,
+    0x11, 0x05, 0x0C, 0x01, 0xA9, 0x01, 0xED, 0xB0, 0xCD, 0x72, 0x0D, 0xD1, 0x21, 0xEA, 0xFF, 0x19,
     0x22, 0x05, 0x0C, 0x0E, 0x04, 0x21, 0x10, 0x00, 0xE5, 0xE1, 0x11, 0x30, 0x00, 0x19, 0xE5, 0x11,
-    0x0F, 0xC3, 0x1A, 0x3C, 0x47, 0x1A, 0xBE, 0x20, 0x2C, 0x23, 0x13, 0x10, 0xF8, 0xE1, 0x3A, 0xFB,
+    0xD1, 0xC5, 0x1A, 0x3C, 0x47, 0x1A, 0xBE, 0x20, 0x2C, 0x23, 0x13, 0x10, 0xF8, 0xE1, 0x3A, 0xFB,
     0x1F, 0xFE, 0xFF, 0xC2, 0x5E, 0xC0, 0x2A, 0x00, 0x00, 0x22, 0x3E, 0x00, 0x18, 0x1B, 0x3A, 0xB7,
-    0x0E, 0xB7, 0xCA, 0x04, 0x0D, 0x3E, 0x00, 0x32, 0xB6, 0x0E, 0x2A, 0x05, 0x0C, 0x3E, 0x20, 0x32,
-    0x03, 0x00, 0xD3, 0x02, 0xE9, 0x0D, 0x20, 0xC1, 0xE1, 0x21, 0x3D, 0xC4, 0x11, 0x95, 0x0B, 0x01,
-    0x0A, 0x00, 0xED, 0xB0, 0x2A, 0x35, 0x0B, 0x22, 0x9D, 0x0B, 0x21, 0x1F, 0xC4, 0x11, 0x23, 0x0B,
-    0x01, 0x1E, 0x00, 0xED, 0xB0, 0x3E, 0x00, 0x32, 0xB8, 0x0E, 0xCD, 0xCC, 0xC0, 0x11, 0x10, 0x00,
-    0x19, 0x5E, 0x23, 0x56, 0x23, 0x7E, 0x32, 0x07, 0x0C, 0x23, 0x4E, 0x23, 0x46, 0x6B, 0x62, 0x11,
-    0xEF, 0x19, 0xCD, 0x66, 0x0C, 0x3A, 0xB7, 0x0E, 0xB7, 0xCA, 0xF6, 0x0C, 0x3E, 0x0F, 0x32, 0xB6,
-    0x0E, 0x2A, 0x05, 0x0C, 0x3E, 0x20, 0x32, 0x03, 0x00, 0xD3, 0x02, 0xE9, 0x3A, 0xB7, 0x0E, 0xB7,
-    0x28, 0x0B, 0x2A, 0x4B, 0xC4, 0x3E, 0xC0, 0xB4, 0x67, 0x3A, 0x48, 0xC4, 0xC9, 0x2A, 0x49, 0xC4,
-    0x3E, 0xC0, 0xB4, 0x67, 0x3A, 0x47, 0xC4, 0xC9, 0x08, 0xF5, 0xE6, 0x70, 0xFE, 0x50, 0xCA, 0xF6,
-    0xC0, 0xF1, 0x08, 0xC3, 0x95, 0x0B, 0xF1, 0xE5, 0xFE, 0xD3, 0xCA, 0x15, 0xC1, 0xFE, 0xD1, 0xCA,
-    0x0B, 0xC2, 0xFE, 0xD2, 0xCA, 0x71, 0xC2, 0xFE, 0xD4, 0xCA, 0xDA, 0xC2, 0xE1, 0xC3, 0xF2, 0xC0,
-    0xE1, 0x08, 0xC3, 0x95, 0x0B, 0x3A, 0xB8, 0x0E, 0xB7, 0x28, 0x05, 0x3E, 0xEB, 0xC3, 0x06, 0xC3,
-    0x6B, 0x62, 0xD5, 0x11, 0xF5, 0x0B, 0x7E, 0xFE, 0x10, 0x38, 0x02, 0x3E, 0x10, 0x32, 0xF4, 0x0B,
-    0x47, 0x23, 0x7E, 0xFE, 0x61, 0x38, 0x12, 0xFE, 0x7B, 0x30, 0x04, 0xE6, 0xDF, 0x18, 0x0A, 0xFE,
-    0x90, 0x38, 0x06, 0xFE, 0x99, 0x30, 0x02, 0xD6, 0x10, 0x12, 0x13, 0x23, 0x10, 0xE4, 0x3A, 0xF4,
-    0x0B, 0x47, 0x21, 0xF5, 0x0B, 0x7E, 0x23, 0xFE, 0x2E, 0x28, 0x20, 0x10, 0xF8, 0x3A, 0xF4, 0x0B,
-    0xFE, 0x0D, 0x30, 0x17, 0x5F, 0xC6, 0x04, 0x32, 0xF4, 0x0B, 0x3E, 0xF5, 0x83, 0x5F, 0x3E, 0x00,
-    0xCE, 0x0B, 0x57, 0x21, 0x0B, 0xC3, 0x01, 0x04, 0x00, 0xED, 0xB0, 0xCD, 0xCC, 0xC0, 0x4F, 0xE5,
-    0x3A, 0xF4, 0x0B, 0x47, 0x11, 0xF5, 0x0B, 0x1A, 0xBE, 0x20, 0x68, 0x23, 0x13, 0x10, 0xF8, 0x3A,
-    0xF4, 0x0B, 0x47, 0x21, 0xF4, 0x0B, 0x23, 0x7E, 0xFE, 0x2E, 0x28, 0x04, 0x10, 0xF8, 0x18, 0x11,
-    0x06, 0x04, 0x11, 0x0B, 0xC3, 0x1A, 0xBE, 0x20, 0x08, 0x23, 0x13, 0x10, 0xF8, 0x3E, 0x01, 0x18,
-    0x02, 0x3E, 0x02, 0x32, 0xB8, 0x0E, 0x21, 0x16, 0xC3, 0x11, 0x05, 0x0C, 0x01, 0x09, 0x01, 0xED,
-    0xB0, 0xC1, 0x21, 0x10, 0x00, 0x09, 0x7E, 0x32, 0x0A, 0x0C, 0x23, 0x7E, 0x32, 0x0B, 0x0C, 0x23,
-    0x7E, 0x32, 0x07, 0x0C, 0x23, 0x7E, 0x32, 0x08, 0x0C, 0x32, 0x0F, 0x0C, 0x23, 0x7E, 0x32, 0x09,
-    0x0C, 0x32, 0x10, 0x0C, 0xAF, 0x32, 0x0C, 0x0C, 0x32, 0x6B, 0x0B, 0xD1, 0x11, 0xF4, 0x0B, 0xAF,
-    0xC3, 0x06, 0xC3, 0xE1, 0x11, 0x15, 0x00, 0x19, 0x0D, 0x79, 0xB7, 0x20, 0x82, 0xD1, 0xC3, 0x06,
-    0xC2, 0x3E, 0xD3, 0xC3, 0x10, 0xC1, 0x3E, 0xE9, 0xC3, 0x06, 0xC3, 0x3A, 0xB8, 0x0E, 0xFE, 0x02,
-    0x28, 0x25, 0xFE, 0x01, 0x28, 0x08, 0xC3, 0x06, 0xC2, 0x3E, 0xD1, 0xC3, 0x10, 0xC1, 0x3A, 0x0C,
-    0x0C, 0xFE, 0x10, 0x30, 0x47, 0x21, 0x0D, 0x0C, 0x85, 0x6F, 0x8C, 0x95, 0x67, 0x4E, 0x3A, 0x0C,
-    0x0C, 0x3C, 0x32, 0x0C, 0x0C, 0x18, 0x31, 0x2A, 0x08, 0x0C, 0x7D, 0xB4, 0x28, 0x2E, 0x3A, 0x0C,
-    0x0C, 0xFE, 0x10, 0x30, 0x27, 0x3C, 0x32, 0x0C, 0x0C, 0x2B, 0x22, 0x08, 0x0C, 0x2A, 0x0A, 0x0C,
-    0xCD, 0x59, 0x0C, 0x2A, 0x0A, 0x0C, 0x23, 0x7C, 0xB5, 0x20, 0x0A, 0x3A, 0x07, 0x0C, 0x3C, 0x32,
-    0x07, 0x0C, 0x21, 0x08, 0xC0, 0x22, 0x0A, 0x0C, 0xAF, 0xC3, 0x06, 0xC3, 0x3E, 0xEC, 0xC3, 0x06,
-    0xC3, 0x3A, 0xB8, 0x0E, 0xB7, 0xC2, 0x80, 0xC2, 0xC3, 0x06, 0xC2, 0x3E, 0xD2, 0xC3, 0x10, 0xC1,
-    0x2A, 0x08, 0x0C, 0x7D, 0xB4, 0x28, 0x4E, 0xB7, 0xED, 0x42, 0x30, 0x07, 0xED, 0x4B, 0x08, 0x0C,
-    0x21, 0x00, 0x00, 0x22, 0x08, 0x0C, 0x3A, 0x0C, 0x0C, 0xFE, 0x10, 0x30, 0x2B, 0x3C, 0x32, 0x0C,
-    0x0C, 0xC5, 0x2A, 0x0A, 0x0C, 0xCD, 0x59, 0x0C, 0x79, 0x12, 0x13, 0x2A, 0x0A, 0x0C, 0x23, 0x7C,
-    0xB5, 0x20, 0x0A, 0x3A, 0x07, 0x0C, 0x3C, 0x32, 0x07, 0x0C, 0x21, 0x08, 0xC0, 0x22, 0x0A, 0x0C,
-    0xC1, 0x0B, 0x79, 0xB0, 0x28, 0x0B, 0x18, 0xCE, 0x2A, 0x0A, 0x0C, 0xCD, 0x66, 0x0C, 0x22, 0x0A,
-    0x0C, 0xAF, 0xC3, 0x06, 0xC3, 0x3E, 0xEC, 0xC3, 0x06, 0xC3, 0x3A, 0xB8, 0x0E, 0xB7, 0xC2, 0xED,
-    0xC2, 0xAF, 0xC3, 0x06, 0xC3, 0xC3, 0x06, 0xC2, 0x3E, 0xD4, 0xC3, 0x10, 0xC1, 0xAF, 0x32, 0x0A,
-    0x0C, 0x32, 0x0B, 0x0C, 0x32, 0x08, 0x0C, 0x32, 0x0F, 0x0C, 0x32, 0x09, 0x0C, 0x32, 0x10, 0x0C,
-    0x32, 0xB8, 0x0E, 0xC3, 0x06, 0xC3, 0xE1, 0xB7, 0xC3, 0x37, 0x0B, 0x2E, 0x43, 0x41, 0x53, 0x06,
-    0x4E, 0x41, 0x4E, 0x4F, 0x53, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
-    0x00, 0x00, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3E, 0x70,
-    0x32, 0x03, 0x00, 0xD3, 0x02, 0x3A, 0xB7, 0x0E, 0xB7, 0x20, 0x27, 0x21, 0x00, 0x17, 0xE5, 0xDD,
-    0xE1, 0x01, 0xEF, 0x02, 0x11, 0x01, 0x17, 0x36, 0x00, 0xED, 0xB0, 0x21, 0xEF, 0x19, 0x22, 0x20,
-    0x17, 0x22, 0x22, 0x17, 0x21, 0x5B, 0xFB, 0x11, 0x08, 0x00, 0x01, 0x27, 0x00, 0xED, 0xB0, 0xCD,
-    0x10, 0xDE, 0x3E, 0x30, 0x32, 0x03, 0x00, 0xD3, 0x02, 0xC9, 0xCD, 0xED, 0x0C, 0x3E, 0xC0, 0xB4,
-    0x67, 0x4E, 0xAF, 0x32, 0x00, 0xFC, 0xC9, 0x78, 0xB1, 0xC8, 0xCD, 0xED, 0x0C, 0x3E, 0xC0, 0xB4,
-    0x67, 0xCD, 0x78, 0x0C, 0xAF, 0x32, 0x00, 0xFC, 0xC9, 0x3E, 0x80, 0xED, 0xA0, 0xCD, 0xD9, 0x0C,
-    0x87, 0xCC, 0xD2, 0x0C, 0x30, 0xF5, 0xD5, 0x01, 0x01, 0x00, 0x50, 0x14, 0x87, 0xCC, 0xD2, 0x0C,
-    0x30, 0xF9, 0xC3, 0x9E, 0x0C, 0x87, 0xCC, 0xD2, 0x0C, 0xCB, 0x11, 0xCB, 0x10, 0x38, 0x30, 0x15,
-    0x20, 0xF3, 0x03, 0x5E, 0x23, 0xCD, 0xD9, 0x0C, 0xCB, 0x33, 0x30, 0x1A, 0x87, 0xCC, 0xD2, 0x0C,
-    0xCB, 0x12, 0x87, 0xCC, 0xD2, 0x0C, 0xCB, 0x12, 0x87, 0xCC, 0xD2, 0x0C, 0xCB, 0x12, 0x87, 0xCC,
-    0xD2, 0x0C, 0x3F, 0x38, 0x01, 0x14, 0xCB, 0x1B, 0xE3, 0xE5, 0xED, 0x52, 0xD1, 0xED, 0xB0, 0xE1,
-    0xD2, 0x7F, 0x0C, 0x7E, 0x23, 0xCD, 0xD9, 0x0C, 0x17, 0xC9, 0xF5, 0x7C, 0xB5, 0x20, 0x0D, 0x3A,
-    0x07, 0x0C, 0x3C, 0x32, 0x07, 0x0C, 0x32, 0x00, 0xFC, 0x21, 0x08, 0xC0, 0xF1, 0xC9, 0xF5, 0x3A,
-    0x07, 0x0C, 0x32, 0x00, 0xFC, 0xF1, 0xC9, 0x3E, 0x70, 0x32, 0x03, 0x00, 0xD3, 0x02, 0xFB, 0x2A,
-    0x22, 0x17, 0xC3, 0x23, 0xDE, 0x3E, 0x70, 0x32, 0x03, 0x00, 0xD3, 0x02, 0xC3, 0x22, 0xC3, 0xE3,
-    0x7E, 0x23, 0xE3, 0x08, 0xF5, 0x3A, 0x03, 0x00, 0xF5, 0x3E, 0x30, 0x32, 0x03, 0x00, 0xD3, 0x02,
-    0xC3, 0xE8, 0xC0, 0x08, 0xF1, 0x32, 0x03, 0x00, 0xD3, 0x02, 0xF1, 0x08, 0xC9, 0x3E, 0x70, 0x32,
-    0x03, 0x00, 0xD3, 0x02, 0xC3, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+    0x0E, 0xB7, 0xCA, 0x68, 0x0D, 0x3E, 0x00, 0x32, 0xB6, 0x0E, 0x2A, 0x05, 0x0C, 0x3E, 0x20, 0x32,
+    0x03, 0x00, 0xD3, 0x02, 0xE9, 0x0D, 0x20, 0xC1, 0xE1, 0x21, 0x9F, 0xC7, 0x11, 0x95, 0x0B, 0x01,
+    0x0A, 0x00, 0xED, 0xB0, 0x2A, 0x35, 0x0B, 0x22, 0x9D, 0x0B, 0x21, 0x81, 0xC7, 0x11, 0x23, 0x0B,
+    0x01, 0x1E, 0x00, 0xED, 0xB0, 0x3E, 0x00, 0x32, 0xB8, 0x0E, 0xCD, 0xEC, 0xC0, 0x5E, 0x23, 0x56,
+    0x23, 0x7E, 0x32, 0x07, 0x0C, 0x23, 0x4E, 0x23, 0x46, 0x23, 0x23, 0x7E, 0x32, 0x0E, 0x0C, 0x6B,
+    0x62, 0x11, 0xEF, 0x19, 0xCD, 0x36, 0x0C, 0x3A, 0xB7, 0x0E, 0xB7, 0xCA, 0x5A, 0x0D, 0x3E, 0x0F,
+    0x32, 0xB6, 0x0E, 0x2A, 0x05, 0x0C, 0x3E, 0x20, 0x32, 0x03, 0x00, 0xD3, 0x02, 0xE9, 0x3A, 0xB7,
+    0x0E, 0xB7, 0x28, 0x0C, 0x2A, 0xAF, 0xC7, 0x3E, 0xC0, 0xB4, 0x67, 0xED, 0x4B, 0xAB, 0xC7, 0xC9,
+    0x2A, 0xAD, 0xC7, 0x3E, 0xC0, 0xB4, 0x67, 0xED, 0x4B, 0xA9, 0xC7, 0xC9, 0x2A, 0xB3, 0xC7, 0x3A,
+    0xB7, 0x0E, 0xB7, 0x28, 0x03, 0x2A, 0xB5, 0xC7, 0x3E, 0xC0, 0xB4, 0x67, 0xC9, 0xE5, 0xD5, 0xC5,
+    0x3A, 0xF4, 0x0B, 0x47, 0x11, 0xF5, 0x0B, 0x23, 0x1A, 0xBE, 0x20, 0x03, 0x13, 0x10, 0xF8, 0xC1,
+    0xD1, 0xE1, 0xC9, 0x08, 0xF5, 0xE6, 0x70, 0xFE, 0x50, 0xCA, 0x21, 0xC1, 0xF1, 0x08, 0xC3, 0x95,
+    0x0B, 0xF1, 0xE5, 0xFE, 0xD3, 0xCA, 0x40, 0xC1, 0xFE, 0xD1, 0xCA, 0x71, 0xC2, 0xFE, 0xD2, 0xCA,
+    0xFF, 0xC2, 0xFE, 0xD4, 0xCA, 0x96, 0xC5, 0xE1, 0xC3, 0x1D, 0xC1, 0xE1, 0x08, 0xC3, 0x95, 0x0B,
+    0x3A, 0xB8, 0x0E, 0xB7, 0x28, 0x05, 0x3E, 0xEB, 0xC3, 0xC8, 0xC5, 0x6B, 0x62, 0xD5, 0x11, 0xF5,
+    0x0B, 0x7E, 0xFE, 0x10, 0x38, 0x02, 0x3E, 0x10, 0x32, 0xF4, 0x0B, 0x47, 0x23, 0x7E, 0xFE, 0x61,
+    0x38, 0x12, 0xFE, 0x7B, 0x30, 0x04, 0xE6, 0xDF, 0x18, 0x0A, 0xFE, 0x90, 0x38, 0x06, 0xFE, 0x99,
+    0x30, 0x02, 0xD6, 0x10, 0x12, 0x13, 0x23, 0x10, 0xE4, 0x3A, 0xF4, 0x0B, 0x47, 0x21, 0xF5, 0x0B,
+    0x7E, 0x23, 0xFE, 0x2E, 0x28, 0x20, 0x10, 0xF8, 0x3A, 0xF4, 0x0B, 0xFE, 0x0D, 0x30, 0x17, 0x5F,
+    0xC6, 0x04, 0x32, 0xF4, 0x0B, 0x3E, 0xF5, 0x83, 0x5F, 0x3E, 0x00, 0xCE, 0x0B, 0x57, 0x21, 0xCD,
+    0xC5, 0x01, 0x04, 0x00, 0xED, 0xB0, 0x3A, 0xF4, 0x0B, 0x47, 0x21, 0xF5, 0x0B, 0x07, 0x07, 0x07,
+    0xAE, 0x23, 0x10, 0xF9, 0x5F, 0x16, 0x01, 0xCD, 0xCE, 0xC0, 0x7E, 0x23, 0x15, 0x14, 0x28, 0x0B,
+    0xBB, 0x20, 0x1B, 0x3A, 0xF4, 0x0B, 0xBE, 0x20, 0x15, 0x18, 0x0E, 0x3A, 0xF4, 0x0B, 0xBE, 0x30,
+    0x0D, 0x23, 0x3A, 0xF5, 0x0B, 0xBE, 0x2B, 0x20, 0x05, 0xCD, 0xFD, 0xC0, 0x28, 0x19, 0x7E, 0xC6,
+    0x08, 0x85, 0x6F, 0x8C, 0x95, 0x67, 0x0B, 0x78, 0xB1, 0x20, 0xCF, 0x15, 0x28, 0xC9, 0xD1, 0xC3,
+    0x6C, 0xC2, 0x3E, 0xD3, 0xC3, 0x3B, 0xC1, 0xE5, 0x3A, 0xF4, 0x0B, 0x47, 0x21, 0xF4, 0x0B, 0x23,
+    0x7E, 0xFE, 0x2E, 0x28, 0x04, 0x10, 0xF8, 0x18, 0x11, 0x06, 0x04, 0x11, 0xCD, 0xC5, 0x1A, 0xBE,
+    0x20, 0x08, 0x23, 0x13, 0x10, 0xF8, 0x3E, 0x01, 0x18, 0x02, 0x3E, 0x02, 0x32, 0xB8, 0x0E, 0x21,
+    0xD8, 0xC5, 0x11, 0x05, 0x0C, 0x01, 0xA9, 0x01, 0xED, 0xB0, 0xE1, 0x4E, 0x06, 0x00, 0x23, 0x09,
+    0x7E, 0x32, 0x0B, 0x0C, 0x23, 0x7E, 0xF6, 0xC0, 0x32, 0x0C, 0x0C, 0x23, 0x7E, 0x32, 0x07, 0x0C,
+    0x23, 0x7E, 0x32, 0x08, 0x0C, 0x32, 0x1F, 0x0C, 0x23, 0x7E, 0x32, 0x09, 0x0C, 0x32, 0x20, 0x0C,
+    0x23, 0x7E, 0x32, 0x0A, 0x0C, 0x23, 0x7E, 0x32, 0x0E, 0x0C, 0xAF, 0x32, 0x0D, 0x0C, 0x32, 0x0F,
+    0x0C, 0x32, 0x6B, 0x0B, 0xD1, 0x11, 0xF4, 0x0B, 0xAF, 0xC3, 0xC8, 0xC5, 0x3E, 0xE9, 0xC3, 0xC8,
+    0xC5, 0x3A, 0xB8, 0x0E, 0xFE, 0x02, 0x28, 0x27, 0xFE, 0x01, 0x28, 0x08, 0xC3, 0x6C, 0xC2, 0x3E,
+    0xD1, 0xC3, 0x3B, 0xC1, 0x3A, 0x0D, 0x0C, 0xFE, 0x10, 0xD2, 0xFA, 0xC2, 0x21, 0x1D, 0x0C, 0x85,
+    0x6F, 0x8C, 0x95, 0x67, 0x4E, 0x3A, 0x0D, 0x0C, 0x3C, 0x32, 0x0D, 0x0C, 0xC3, 0xF6, 0xC2, 0x2A,
+    0x10, 0x0C, 0x3A, 0x0F, 0x0C, 0xB7, 0x20, 0x41, 0x2A, 0x08, 0x0C, 0x3A, 0x0A, 0x0C, 0xB5, 0xB4,
+    0xCA, 0xFA, 0xC2, 0x3A, 0x0E, 0x0C, 0xE6, 0x01, 0x28, 0x05, 0xCD, 0x05, 0xC4, 0x18, 0x2A, 0x01,
+    0x40, 0x00, 0xCD, 0xE6, 0xC3, 0x79, 0x32, 0x0F, 0x0C, 0x11, 0x72, 0x0D, 0x2A, 0x0B, 0x0C, 0xCD,
+    0x36, 0x0C, 0x7C, 0xB5, 0x20, 0x0A, 0x3A, 0x07, 0x0C, 0x3C, 0x32, 0x07, 0x0C, 0x21, 0x08, 0xC0,
+    0x22, 0x0B, 0x0C, 0x21, 0x72, 0x0D, 0x3A, 0x0F, 0x0C, 0x3D, 0x32, 0x0F, 0x0C, 0x4E, 0x23, 0x22,
+    0x10, 0x0C, 0xAF, 0xC3, 0xC8, 0xC5, 0xAF, 0xC3, 0xC8, 0xC5, 0x3E, 0xEC, 0xC3, 0xC8, 0xC5, 0x3A,
+    0xB8, 0x0E, 0xB7, 0xC2, 0x0E, 0xC3, 0xC3, 0x6C, 0xC2, 0x3E, 0xD2, 0xC3, 0x3B, 0xC1, 0x3A, 0x0F,
+    0x0C, 0xB7, 0x28, 0x40, 0x78, 0xB7, 0x20, 0x19, 0xB1, 0xCA, 0x86, 0xC3, 0x3A, 0x0F, 0x0C, 0xB9,
+    0x38, 0x0F, 0x91, 0x32, 0x0F, 0x0C, 0x2A, 0x10, 0x0C, 0xED, 0xB0, 0x22, 0x10, 0x0C, 0xC3, 0x86,
+    0xC3, 0x3A, 0x0F, 0x0C, 0x60, 0x69, 0x4F, 0x06, 0x00, 0xB7, 0xED, 0x42, 0xE5, 0x2A, 0x10, 0x0C,
+    0xED, 0xB0, 0xAF, 0x32, 0x0F, 0x0C, 0xC1, 0x2A, 0x08, 0x0C, 0x3A, 0x0A, 0x0C, 0xB5, 0xB4, 0xCA,
+    0x86, 0xC3, 0x18, 0x0A, 0x2A, 0x08, 0x0C, 0x3A, 0x0A, 0x0C, 0xB5, 0xB4, 0x28, 0x2C, 0x3A, 0x0E,
+    0x0C, 0xE6, 0x01, 0x28, 0x07, 0x3A, 0xB8, 0x0E, 0xFE, 0x02, 0x28, 0x23, 0xCD, 0xE6, 0xC3, 0x2A,
+    0x0B, 0x0C, 0xCD, 0x36, 0x0C, 0x7C, 0xB5, 0x20, 0x0A, 0x3A, 0x07, 0x0C, 0x3C, 0x32, 0x07, 0x0C,
+    0x21, 0x08, 0xC0, 0x22, 0x0B, 0x0C, 0xAF, 0xC3, 0xC8, 0xC5, 0x3E, 0xEC, 0xC3, 0xC8, 0xC5, 0x3A,
+    0x0D, 0x0C, 0xB7, 0x28, 0x47, 0x3A, 0x0E, 0x0C, 0xE6, 0x80, 0x20, 0x40, 0xCD, 0x2E, 0xC4, 0x20,
+    0x03, 0x21, 0x00, 0x04, 0x3A, 0x0A, 0x0C, 0xB7, 0x20, 0x0D, 0xD5, 0xEB, 0x2A, 0x08, 0x0C, 0xB7,
+    0xED, 0x52, 0x19, 0x38, 0x01, 0xEB, 0xD1, 0x79, 0x95, 0x78, 0x9C, 0x38, 0x1F, 0xC5, 0x44, 0x4D,
+    0xC5, 0xCD, 0xE6, 0xC3, 0x2A, 0x0B, 0x0C, 0xCD, 0x36, 0x0C, 0x2B, 0x2B, 0xCD, 0x2E, 0xC5, 0xC1,
+    0xE1, 0xB7, 0xED, 0x42, 0x44, 0x4D, 0xC2, 0x47, 0xC3, 0xC3, 0x86, 0xC3, 0xC5, 0xD5, 0xCD, 0x05,
+    0xC4, 0xD1, 0xC1, 0xC3, 0x0E, 0xC3, 0x2A, 0x08, 0x0C, 0xB7, 0xED, 0x42, 0x30, 0x13, 0x3A, 0x0A,
+    0x0C, 0xD6, 0x01, 0x38, 0x05, 0x32, 0x0A, 0x0C, 0x18, 0x07, 0xED, 0x4B, 0x08, 0x0C, 0x21, 0x00,
+    0x00, 0x22, 0x08, 0x0C, 0xC9, 0x3A, 0x0D, 0x0C, 0xB7, 0x20, 0x39, 0x01, 0x10, 0x00, 0xCD, 0xE6,
+    0xC3, 0x79, 0x32, 0x0D, 0x0C, 0x32, 0x0F, 0x0C, 0x11, 0x72, 0x0D, 0x2A, 0x0B, 0x0C, 0xCD, 0x2D,
+    0x0C, 0x22, 0x0B, 0x0C, 0x21, 0x72, 0x0D, 0x22, 0x10, 0x0C, 0x3A, 0x0F, 0x0C, 0xC9, 0xD5, 0xED,
+    0x5B, 0x1F, 0x0C, 0x2A, 0x08, 0x0C, 0xB7, 0xED, 0x52, 0xD1, 0x7C, 0xE6, 0x03, 0x67, 0x7D, 0xE6,
+    0xFF, 0x6F, 0xB4, 0xC9, 0xCD, 0x2E, 0xC4, 0x7D, 0xE6, 0x1F, 0x20, 0x02, 0x3E, 0x20, 0x4F, 0x06,
+    0x00, 0xCD, 0xE6, 0xC3, 0x79, 0x32, 0x0F, 0x0C, 0xC5, 0x2A, 0x1B, 0x0C, 0x11, 0x80, 0xFF, 0x19,
+    0x11, 0xB2, 0x0D, 0x01, 0x80, 0x00, 0xED, 0xB0, 0xED, 0x53, 0x10, 0x0C, 0xC1, 0x3A, 0x17, 0x0C,
+    0x47, 0x21, 0x0E, 0x0C, 0x7E, 0xE6, 0x80, 0x20, 0x0C, 0x7E, 0xF6, 0x80, 0x77, 0xAF, 0x32, 0x14,
+    0x0C, 0x06, 0x80, 0x18, 0x0C, 0x2A, 0x18, 0x0C, 0x7C, 0xB5, 0x20, 0x33, 0xCD, 0x49, 0xC5, 0x38,
+    0x0A, 0xCD, 0x53, 0xC5, 0x12, 0x13, 0x0D, 0x20, 0xF3, 0x18, 0x4A, 0xD5, 0x16, 0x00, 0x14, 0xCD,
+    0x49, 0xC5, 0x30, 0xFA, 0x7A, 0xFE, 0x11, 0x30, 0x6E, 0x21, 0x01, 0x00, 0x15, 0x28, 0x07, 0xCD,
+    0x49, 0xC5, 0xED, 0x6A, 0x18, 0xF6, 0xD1, 0x23, 0xCD, 0x53, 0xC5, 0x2F, 0x32, 0x1A, 0x0C, 0x7C,
+    0xB7, 0x20, 0x04, 0x7D, 0xB9, 0x38, 0x01, 0x79, 0xC5, 0x4F, 0x06, 0x00, 0xB7, 0xED, 0x42, 0x22,
+    0x18, 0x0C, 0xE1, 0x7D, 0x91, 0x6F, 0xE5, 0x3A, 0x1A, 0x0C, 0x6F, 0x26, 0xFF, 0x19, 0xED, 0xB0,
+    0xC1, 0x79, 0xB7, 0x20, 0xA7, 0x78, 0x32, 0x17, 0x0C, 0xED, 0x53, 0x1B, 0x0C, 0xCD, 0x2E, 0xC4,
+    0x20, 0x1E, 0x0E, 0x12, 0xCD, 0x49, 0xC5, 0x0D, 0x20, 0xFA, 0x2A, 0x0B, 0x0C, 0x3A, 0x14, 0x0C,
+    0x4F, 0x06, 0x00, 0xB7, 0xED, 0x42, 0xCD, 0x2E, 0xC5, 0x21, 0x0E, 0x0C, 0x7E, 0xE6, 0x7F, 0x77,
+    0x2A, 0x10, 0x0C, 0x3A, 0x0F, 0x0C, 0xC9, 0xD1, 0xAF, 0x32, 0x14, 0x0C, 0x3A, 0x07, 0x0C, 0x3C,
+    0x32, 0x07, 0x0C, 0x21, 0x08, 0xC0, 0x22, 0x0B, 0x0C, 0x06, 0x80, 0xC3, 0x8C, 0xC4, 0x7C, 0xB5,
+    0x28, 0x09, 0x7C, 0x3C, 0x20, 0x0F, 0x7D, 0xFE, 0xFD, 0x38, 0x0A, 0x3A, 0x07, 0x0C, 0x3C, 0x32,
+    0x07, 0x0C, 0x21, 0x08, 0xC0, 0x22, 0x0B, 0x0C, 0xC9, 0xCB, 0x20, 0xC0, 0xCD, 0x53, 0xC5, 0x37,
+    0x17, 0x47, 0xC9, 0xE5, 0x3A, 0x14, 0x0C, 0xB7, 0x28, 0x0E, 0x3D, 0x32, 0x14, 0x0C, 0x2A, 0x15,
+    0x0C, 0x7E, 0x23, 0x22, 0x15, 0x0C, 0xE1, 0xC9, 0xC5, 0xD5, 0x2A, 0x0B, 0x0C, 0xAF, 0x95, 0x4F,
+    0x3E, 0x00, 0x9C, 0x47, 0x20, 0x05, 0x79, 0xFE, 0x40, 0x38, 0x03, 0x01, 0x40, 0x00, 0x79, 0x32,
+    0x14, 0x0C, 0x11, 0x72, 0x0D, 0xED, 0x53, 0x15, 0x0C, 0xCD, 0x2D, 0x0C, 0x22, 0x0B, 0x0C, 0xD1,
+    0xC1, 0x3A, 0x14, 0x0C, 0x18, 0xC4, 0x3A, 0xB8, 0x0E, 0xB7, 0xC2, 0xA9, 0xC5, 0xAF, 0xC3, 0xC8,
+    0xC5, 0xC3, 0x6C, 0xC2, 0x3E, 0xD4, 0xC3, 0x3B, 0xC1, 0xAF, 0x32, 0x0B, 0x0C, 0x32, 0x0C, 0x0C,
+    0x32, 0x08, 0x0C, 0x32, 0x1F, 0x0C, 0x32, 0x09, 0x0C, 0x32, 0x20, 0x0C, 0x32, 0x0A, 0x0C, 0x32,
+    0x0F, 0x0C, 0x32, 0xB8, 0x0E, 0xC3, 0xC8, 0xC5, 0xE1, 0xB7, 0xC3, 0x37, 0x0B, 0x2E, 0x43, 0x41,
+    0x53, 0x06, 0x4E, 0x41, 0x4E, 0x4F, 0x53, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00, 0x32, 0x0E,
+    0x00, 0x01, 0x00, 0x00, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xCD, 0x51, 0x0D, 0x3E, 0xC0, 0xB4, 0x67, 0x18, 0x16, 0x78, 0xB1, 0xC8, 0xCD, 0x51, 0x0D, 0x3E,
+    0xC0, 0xB4, 0x67, 0x3A, 0x0E, 0x0C, 0xE6, 0x01, 0x28, 0x05, 0xCD, 0x7E, 0x0C, 0x18, 0x03, 0xCD,
+    0x54, 0x0C, 0xAF, 0x32, 0x00, 0xFC, 0xC9, 0xC5, 0xAF, 0x95, 0x4F, 0x3E, 0x00, 0x9C, 0x47, 0xE3,
+    0xB7, 0xED, 0x42, 0x38, 0x15, 0x28, 0x13, 0xE3, 0xED, 0xB0, 0xC1, 0x3A, 0x07, 0x0C, 0x3C, 0x32,
+    0x07, 0x0C, 0xCD, 0x51, 0x0D, 0x21, 0x08, 0xC0, 0x18, 0xDD, 0x09, 0x44, 0x4D, 0xE1, 0xED, 0xB0,
+    0xC9, 0xE5, 0x62, 0x6B, 0x09, 0x22, 0x12, 0x0C, 0xE1, 0x3A, 0x0E, 0x0C, 0xE6, 0x02, 0x20, 0x62,
+    0x3E, 0x80, 0xED, 0xA0, 0x87, 0xCC, 0xEB, 0x0C, 0x30, 0xF8, 0xD5, 0x01, 0x01, 0x00, 0x50, 0x14,
+    0x87, 0xCC, 0xEB, 0x0C, 0x30, 0xF9, 0xC3, 0xB0, 0x0C, 0x87, 0xCC, 0xEB, 0x0C, 0xCB, 0x11, 0xCB,
+    0x10, 0x38, 0x31, 0x15, 0x20, 0xF3, 0x03, 0x5E, 0x23, 0xCB, 0x33, 0x30, 0x1A, 0x87, 0xCC, 0xEB,
+    0x0C, 0xCB, 0x12, 0x87, 0xCC, 0xEB, 0x0C, 0xCB, 0x12, 0x87, 0xCC, 0xEB, 0x0C, 0xCB, 0x12, 0x87,
+    0xCC, 0xEB, 0x0C, 0x3F, 0x38, 0x01, 0x14, 0xCB, 0x1B, 0xE3, 0xE5, 0xED, 0x52, 0xD1, 0xED, 0xB0,
+    0xE1, 0xC3, 0x91, 0x0C, 0xD1, 0xCD, 0x3A, 0x0D, 0xD8, 0x3E, 0x80, 0xC3, 0x91, 0x0C, 0x7E, 0x23,
+    0x17, 0xC9, 0x7E, 0x23, 0xF5, 0xE6, 0x70, 0x28, 0x0E, 0x0F, 0x0F, 0x0F, 0x0F, 0x4F, 0x06, 0x00,
+    0xFE, 0x07, 0xCC, 0x30, 0x0D, 0xED, 0xB0, 0xF1, 0x4E, 0x23, 0x06, 0xFF, 0x87, 0x30, 0x06, 0x46,
+    0x23, 0x04, 0x05, 0x28, 0x18, 0xD5, 0xEB, 0x09, 0xE3, 0xEB, 0xE6, 0x1E, 0x0F, 0xC6, 0x03, 0x4F,
+    0x06, 0x00, 0xFE, 0x12, 0xCC, 0x30, 0x0D, 0xE3, 0xED, 0xB0, 0xE1, 0x18, 0xC5, 0xCD, 0x3A, 0x0D,
+    0xD8, 0x18, 0xBF, 0x4E, 0x23, 0x0C, 0x0D, 0xC0, 0x4E, 0x23, 0x46, 0x23, 0xC9, 0xE5, 0x2A, 0x12,
+    0x0C, 0x37, 0xED, 0x52, 0xE1, 0xD8, 0x3A, 0x07, 0x0C, 0x3C, 0x32, 0x07, 0x0C, 0x32, 0x00, 0xFC,
+    0x21, 0x08, 0xC0, 0xC9, 0xF5, 0x3A, 0x07, 0x0C, 0x32, 0x00, 0xFC, 0xF1, 0xC9, 0x3E, 0x70, 0x32,
+    0x03, 0x00, 0xD3, 0x02, 0xFB, 0x2A, 0x22, 0x17, 0xC3, 0x23, 0xDE, 0x3E, 0x70, 0x32, 0x03, 0x00,
+    0xD3, 0x02, 0xC3, 0x22, 0xC3, 0x3E, 0x70, 0x32, 0x03, 0x00, 0xD3, 0x02, 0x3A, 0xB7, 0x0E, 0xB7,
+    0x20, 0x27, 0x21, 0x00, 0x17, 0xE5, 0xDD, 0xE1, 0x01, 0xEF, 0x02, 0x11, 0x01, 0x17, 0x36, 0x00,
+    0xED, 0xB0, 0x21, 0xEF, 0x19, 0x22, 0x20, 0x17, 0x22, 0x22, 0x17, 0x21, 0x5B, 0xFB, 0x11, 0x08,
+    0x00, 0x01, 0x27, 0x00, 0xED, 0xB0, 0xCD, 0x10, 0xDE, 0x3E, 0x30, 0x32, 0x03, 0x00, 0xD3, 0x02,
+    0xC9, 0xE3, 0x7E, 0x23, 0xE3, 0x08, 0xF5, 0x3A, 0x03, 0x00, 0xF5, 0x3E, 0x30, 0x32, 0x03, 0x00,
+    0xD3, 0x02, 0xC3, 0x13, 0xC1, 0x08, 0xF1, 0x32, 0x03, 0x00, 0xD3, 0x02, 0xF1, 0x08, 0xC9, 0x3E,
+    0x70, 0x32, 0x03, 0x00, 0xD3, 0x02, 0xC3, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
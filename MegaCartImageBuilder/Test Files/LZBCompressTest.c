@@ -0,0 +1,304 @@
+/*****************************************************************************/
+/* MegaCartImageBuilder - Videoton TV Computer 1MByte Cart Image Builder     */
+/* LZB compressor test                                                       */
+/*                                                                           */
+/* Copyright (C) 2021-2023 Laszlo Arvai                                      */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* This software may be modified and distributed under the terms             */
+/* of the BSD license.  See the LICENSE file for details.                    */
+/*****************************************************************************/
+
+// Standalone test of the LZB compressor (not part of the image builder project). Compresses incompressible,
+// run heavy and mixed data, checks that the compressed length doesn't exceed LZBCompressBound and that the
+// data decompresses (as one block and split into page segments) to the original content.
+//
+// Build and run from the MegaCartImageBuilder folder:
+//   gcc -O2 -I"Include Files" "Test Files/LZBCompressTest.c" "Source Files/LZBCompress.c" -o lzbtest && ./lzbtest
+//   cl /O2 /I"Include Files" "Test Files\LZBCompressTest.c" "Source Files\LZBCompress.c" && LZBCompressTest.exe
+// The exit code is zero when all tests pass.
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "LZBCompress.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants
+#define TEST_COUNT 400
+#define TEST_MAX_LENGTH 20000
+#define GUARD_SIZE 64							// bytes after the bound which must not be written
+#define GUARD_BYTE 0xA5
+#define SEARCH_DEPTH 64
+#define LZB_FIRST_SEGMENT_MIN_SIZE 4	// the builder starts a compressed file on the next page below this size (ZX7_MIN_FIRST_SEGMENT_SIZE)
+#define SEGMENT_MIN_SIZE 16						// the longest sequence and the end marker fit into a segment
+
+#define DATA_INCOMPRESSIBLE 0
+#define DATA_RUNS 1								// long runs of one byte value
+#define DATA_LONG_LITERALS 2			// matches followed by literal runs longer than 255 bytes
+#define DATA_MIXED 3
+#define DATA_TYPE_COUNT 4
+
+///////////////////////////////////////////////////////////////////////////////
+// Function prototypes
+static uint32_t GetRandom(void);
+static void GenerateData(uint8_t* out_data, int in_length, int in_type);
+static int Decompress(uint8_t* inout_buffer, int in_output_pos, int in_buffer_size, const uint8_t* in_data, int in_length);
+static int ReadLength(const uint8_t* in_data, int in_length, int* inout_pos);
+static bool TestSegments(const uint8_t* in_data, int in_length, const uint8_t* in_compressed, int in_compressed_length, int in_first_segment_size, int in_segment_size);
+
+///////////////////////////////////////////////////////////////////////////////
+// Global variables
+static uint32_t g_random_state = 12345;
+static const char* g_data_type_names[] = { "incompressible", "runs", "long literals", "mixed" };
+
+///////////////////////////////////////////////////////////////////////////////
+// Main function
+int main(void)
+{
+	uint8_t* data = (uint8_t*)malloc(TEST_MAX_LENGTH);
+	uint8_t* compressed = (uint8_t*)malloc(LZBCompressBound(TEST_MAX_LENGTH) + GUARD_SIZE);
+	uint8_t* decompressed = (uint8_t*)malloc(TEST_MAX_LENGTH);
+	int failed_count = 0;
+	int max_overhead[DATA_TYPE_COUNT] = { 0 };
+	int length;
+	int bound;
+	int compressed_length;
+	int type;
+	int i, j;
+
+	if (data == NULL || compressed == NULL || decompressed == NULL)
+	{
+		printf("Insufficient memory!\n");
+		return 1;
+	}
+
+	for (i = 0; i < TEST_COUNT; i++)
+	{
+		type = i % DATA_TYPE_COUNT;
+		length = 1 + GetRandom() % TEST_MAX_LENGTH;
+		GenerateData(data, length, type);
+
+		bound = LZBCompressBound(length);
+		memset(compressed, GUARD_BYTE, bound + GUARD_SIZE);
+
+		compressed_length = LZBCompress(compressed, data, length, SEARCH_DEPTH);
+
+		// the bound must hold and the bytes after the bound must not be written
+		for (j = bound; j < bound + GUARD_SIZE && compressed[j] == GUARD_BYTE; j++)
+			;
+
+		if (compressed_length <= 0 || compressed_length > bound || j < bound + GUARD_SIZE)
+		{
+			printf("FAILED: %s data, %d bytes compressed to %d bytes, bound is %d bytes\n", g_data_type_names[type], length, compressed_length, bound);
+			failed_count++;
+			continue;
+		}
+
+		if (compressed_length - length > max_overhead[type])
+			max_overhead[type] = compressed_length - length;
+
+		if (Decompress(decompressed, 0, TEST_MAX_LENGTH, compressed, compressed_length) != length || memcmp(decompressed, data, length) != 0)
+		{
+			printf("FAILED: %s data, %d bytes decompressed incorrectly\n", g_data_type_names[type], length);
+			failed_count++;
+			continue;
+		}
+
+		// the first segment fills the rest of a page, the others start at the beginning of the next page
+		if (!TestSegments(data, length, compressed, compressed_length, LZB_FIRST_SEGMENT_MIN_SIZE + GetRandom() % 100, SEGMENT_MIN_SIZE + GetRandom() % 3000))
+		{
+			printf("FAILED: %s data, %d bytes segmented data decompressed incorrectly\n", g_data_type_names[type], length);
+			failed_count++;
+		}
+	}
+
+	for (type = 0; type < DATA_TYPE_COUNT; type++)
+		printf("%-16s max. overhead %d bytes\n", g_data_type_names[type], max_overhead[type]);
+
+	printf("%d tests, %d failed\n", TEST_COUNT, failed_count);
+
+	free(data);
+	free(compressed);
+	free(decompressed);
+
+	return (failed_count == 0) ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the next pseudo random number (xorshift, the tests are repeatable)
+static uint32_t GetRandom(void)
+{
+	g_random_state ^= g_random_state << 13;
+	g_random_state ^= g_random_state >> 17;
+	g_random_state ^= g_random_state << 5;
+
+	return g_random_state;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Generates test data of the given type
+static void GenerateData(uint8_t* out_data, int in_length, int in_type)
+{
+	int run_length = 0;
+	int value = 0;
+	int i;
+
+	for (i = 0; i < in_length; i++)
+	{
+		switch (in_type)
+		{
+			case DATA_INCOMPRESSIBLE:
+				out_data[i] = (uint8_t)GetRandom();
+				break;
+
+			case DATA_RUNS:
+				if (run_length == 0)
+				{
+					run_length = 1 + GetRandom() % 1000;
+					value = GetRandom() & 0xFF;
+				}
+				out_data[i] = (uint8_t)value;
+				run_length--;
+				break;
+
+			case DATA_LONG_LITERALS:
+				// 16 bytes repeated from the beginning followed by 256-600 random bytes
+				if (run_length == 0)
+				{
+					run_length = 16 + 256 + GetRandom() % 345;
+					value = run_length;
+				}
+				out_data[i] = (value - run_length < 16 && i >= 16) ? out_data[i % 16] : (uint8_t)GetRandom();
+				run_length--;
+				break;
+
+			default:
+				out_data[i] = (GetRandom() % 3 == 0 || i < 300) ? (uint8_t)GetRandom() : out_data[i - 300 + GetRandom() % 4];
+				break;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Decompresses the data up to the end marker after the already decompressed data (the matches might refer
+// to it). Returns the decompressed length or -1 if the data is invalid.
+static int Decompress(uint8_t* inout_buffer, int in_output_pos, int in_buffer_size, const uint8_t* in_data, int in_length)
+{
+	int pos = 0;
+	int output_length = in_output_pos;
+	int token;
+	int count;
+	int offset;
+
+	while (pos < in_length)
+	{
+		token = in_data[pos++];
+
+		// literals
+		count = (token >> 4) & 0x07;
+		if (count == 0x07)
+			count = ReadLength(in_data, in_length, &pos);
+
+		if (count < 0 || pos + count > in_length || output_length + count > in_buffer_size)
+			return -1;
+
+		memcpy(inout_buffer + output_length, in_data + pos, count);
+		pos += count;
+		output_length += count;
+
+		// offset
+		if (pos >= in_length)
+			return -1;
+
+		offset = in_data[pos++];
+		if ((token & 0x80) != 0)
+		{
+			if (pos >= in_length)
+				return -1;
+
+			offset |= in_data[pos++] << 8;
+			if ((offset >> 8) == 0)
+				return (pos == in_length) ? output_length : -1;
+		}
+		else
+		{
+			offset |= 0xFF00;
+		}
+		offset = 0x10000 - offset;
+
+		// match
+		count = (token & 0x0F) + LZB_MIN_MATCH;
+		if (count == 0x0F + LZB_MIN_MATCH)
+			count = ReadLength(in_data, in_length, &pos);
+
+		if (count < 0 || offset > output_length || output_length + count > in_buffer_size)
+			return -1;
+
+		for (; count > 0; count--, output_length++)
+			inout_buffer[output_length] = inout_buffer[output_length - offset];
+	}
+
+	return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads an extended length, returns -1 if the data is too short
+static int ReadLength(const uint8_t* in_data, int in_length, int* inout_pos)
+{
+	int length;
+
+	if (*inout_pos >= in_length)
+		return -1;
+
+	length = in_data[(*inout_pos)++];
+	if (length == 0)
+	{
+		if (*inout_pos + 2 > in_length)
+			return -1;
+
+		length = in_data[*inout_pos] | (in_data[*inout_pos + 1] << 8);
+		*inout_pos += 2;
+	}
+
+	return length;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Splits the compressed data into segments of the given size and checks the decompressed content. The segments
+// after the first one must contain data (otherwise the data can't be stored).
+static bool TestSegments(const uint8_t* in_data, int in_length, const uint8_t* in_compressed, int in_compressed_length, int in_first_segment_size, int in_segment_size)
+{
+	LZBSegmentReader reader;
+	uint8_t* segment = (uint8_t*)malloc((in_segment_size > in_first_segment_size) ? in_segment_size : in_first_segment_size);
+	uint8_t* decompressed = (uint8_t*)malloc(in_length);
+	int decompressed_length = 0;
+	int previous_length;
+	int segment_length;
+	int segment_size = in_first_segment_size;
+	bool success = (segment != NULL && decompressed != NULL);
+
+	LZBSegmentReaderInit(&reader, in_compressed, in_compressed_length);
+
+	while (success && !reader.Finished)
+	{
+		segment_length = LZBEncodeSegment(&reader, segment, segment_size);
+
+		// the decoder keeps the decompressed data between the segments
+		previous_length = decompressed_length;
+		decompressed_length = (segment_length > 0) ? Decompress(decompressed, decompressed_length, in_length, segment, segment_length) : -1;
+		if (decompressed_length < 0 || (decompressed_length == previous_length && segment_size == in_segment_size && !reader.Finished))
+			success = false;
+
+		segment_size = in_segment_size;
+	}
+
+	success = success && decompressed_length == in_length && memcmp(decompressed, in_data, in_length) == 0;
+
+	free(segment);
+	free(decompressed);
+
+	return success;
+}
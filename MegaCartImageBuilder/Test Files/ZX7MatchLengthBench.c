@@ -0,0 +1,238 @@
+/*****************************************************************************/
+/* MegaCartImageBuilder - Videoton TV Computer 1MByte Cart Image Builder     */
+/* ZX7 match length kernel benchmark                                         */
+/*                                                                           */
+/* Copyright (C) 2021-2023 Laszlo Arvai                                      */
+/* All rights reserved.                                                      */
+/*                                                                           */
+/* This software may be modified and distributed under the terms             */
+/* of the BSD license.  See the LICENSE file for details.                    */
+/*****************************************************************************/
+
+// Standalone benchmark of the match length extension kernels of ZX7Optimize (not part of the image builder
+// project). The kernels are static, the source file is included. Generates run heavy (graphics screens, level
+// maps) and mixed (program and data) test data, records the match candidates of each position and replays the
+// calls with the scalar, SSE2 and AVX2 (when supported by the CPU) kernels. The results of the kernels must be
+// identical.
+//
+// Build and run from the MegaCartImageBuilder folder (x86 or x64, optimized build):
+//   gcc -O2 -I"Include Files" "Test Files/ZX7MatchLengthBench.c" -o zx7bench && ./zx7bench
+//   cl /O2 /I"Include Files" "Test Files\ZX7MatchLengthBench.c" && ZX7MatchLengthBench.exe
+// The exit code is zero when the kernels return the same lengths.
+
+///////////////////////////////////////////////////////////////////////////////
+// Includes
+#include <time.h>
+#include "../Source Files/ZX7Optimize.c"
+
+///////////////////////////////////////////////////////////////////////////////
+// Constants
+#define DATA_LENGTH 65536
+#define CANDIDATE_COUNT 8					// match candidates checked at each position
+#define MAX_CANDIDATE_OFFSET 2176	// longest ZX7 offset
+#define MIN_BENCH_TIME 0.5				// seconds spent with one kernel
+
+#define DATA_RUNS 0								// long runs of a few byte values
+#define DATA_MIXED 1							// short repeated sequences and random bytes
+#define DATA_TYPE_COUNT 2
+
+///////////////////////////////////////////////////////////////////////////////
+// Types
+
+/// <summary>
+/// One recorded kernel call
+/// </summary>
+typedef struct
+{
+	uint32_t Position;
+	uint32_t Match;
+	uint32_t MaxLength;
+} MatchLengthCall;
+
+/// <summary>
+/// Kernel to measure
+/// </summary>
+typedef struct
+{
+	const char* Name;
+	match_length_function Function;
+} MatchLengthKernel;
+
+///////////////////////////////////////////////////////////////////////////////
+// Function prototypes
+static uint32_t GetRandom(void);
+static void GenerateData(unsigned char* out_data, int in_length, int in_type);
+static int RecordCalls(const unsigned char* in_data, int in_length, MatchLengthCall* out_calls);
+static double MeasureKernel(match_length_function in_function, const unsigned char* in_data, const MatchLengthCall* in_calls, int in_call_count, uint64_t* out_length_sum);
+
+///////////////////////////////////////////////////////////////////////////////
+// Global variables
+static uint32_t g_random_state = 12345;
+static const char* g_data_type_names[] = { "runs", "mixed" };
+
+///////////////////////////////////////////////////////////////////////////////
+// Main function
+int main(void)
+{
+	MatchLengthKernel kernels[3];
+	unsigned char* data = (unsigned char*)malloc(DATA_LENGTH);
+	MatchLengthCall* calls = (MatchLengthCall*)malloc(DATA_LENGTH * CANDIDATE_COUNT * sizeof(MatchLengthCall));
+	uint64_t length_sum;
+	uint64_t reference_sum = 0;
+	double seconds;
+	int kernel_count = 0;
+	int call_count;
+	int failed_count = 0;
+	int type;
+	int k;
+
+	if (data == NULL || calls == NULL)
+	{
+		printf("Insufficient memory!\n");
+		return 1;
+	}
+
+	kernels[kernel_count].Name = "scalar";
+	kernels[kernel_count++].Function = match_length_scalar;
+#ifdef SIMD_MATCH_LENGTH
+	kernels[kernel_count].Name = "SSE2";
+	kernels[kernel_count++].Function = match_length_sse2;
+	if (avx2_supported())
+	{
+		kernels[kernel_count].Name = "AVX2";
+		kernels[kernel_count++].Function = match_length_avx2;
+	}
+#endif
+
+	for (type = 0; type < DATA_TYPE_COUNT; type++)
+	{
+		GenerateData(data, DATA_LENGTH, type);
+		call_count = RecordCalls(data, DATA_LENGTH, calls);
+
+		for (k = 0; k < kernel_count; k++)
+		{
+			seconds = MeasureKernel(kernels[k].Function, data, calls, call_count, &length_sum);
+
+			if (k == 0)
+				reference_sum = length_sum;
+
+			printf("%-6s %-7s %8d calls %6.1f bytes/call %8.1f MB/s%s\n", g_data_type_names[type], kernels[k].Name, call_count, (double)length_sum / call_count,
+				(double)length_sum / seconds / 1000000.0, (length_sum == reference_sum) ? "" : "  FAILED (different lengths)");
+
+			if (length_sum != reference_sum)
+				failed_count++;
+		}
+	}
+
+	free(data);
+	free(calls);
+
+	return (failed_count == 0) ? 0 : 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gets the next pseudo random number (xorshift, the tests are repeatable)
+static uint32_t GetRandom(void)
+{
+	g_random_state ^= g_random_state << 13;
+	g_random_state ^= g_random_state >> 17;
+	g_random_state ^= g_random_state << 5;
+
+	return g_random_state;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Generates test data of the given type
+static void GenerateData(unsigned char* out_data, int in_length, int in_type)
+{
+	int run_length = 0;
+	int value = 0;
+	int i;
+
+	for (i = 0; i < in_length; i++)
+	{
+		if (in_type == DATA_RUNS)
+		{
+			// runs of 4-200 bytes using 4 byte values (screen colors, map tiles)
+			if (run_length == 0)
+			{
+				run_length = 4 + GetRandom() % 197;
+				value = GetRandom() % 4;
+			}
+			out_data[i] = (unsigned char)value;
+			run_length--;
+		}
+		else
+		{
+			// random bytes and copies of 3-20 earlier bytes
+			if (run_length == 0)
+			{
+				run_length = (GetRandom() % 2 == 0 && i > 1000) ? 3 + GetRandom() % 18 : 1;
+				value = (run_length > 1) ? 1 + GetRandom() % 1000 : 0;
+			}
+			out_data[i] = (value > 0) ? out_data[i - value] : (unsigned char)GetRandom();
+			run_length--;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Records the match candidates of each position (the previous positions with the same byte value, the
+// optimizer compares the reversed data backwards the same way). Returns the number of calls.
+static int RecordCalls(const unsigned char* in_data, int in_length, MatchLengthCall* out_calls)
+{
+	int last_position[256];
+	int call_count = 0;
+	int candidate_count;
+	int match;
+	int i;
+
+	for (i = 0; i < 256; i++)
+		last_position[i] = -1;
+
+	for (i = 0; i < in_length; i++)
+	{
+		candidate_count = 0;
+		for (match = last_position[in_data[i]]; match >= 0 && i - match <= MAX_CANDIDATE_OFFSET && candidate_count < CANDIDATE_COUNT; match--)
+		{
+			if (in_data[match] != in_data[i])
+				continue;
+
+			out_calls[call_count].Position = i;
+			out_calls[call_count].Match = match;
+			out_calls[call_count].MaxLength = (match < MAX_LEN) ? match + 1 : MAX_LEN;
+			call_count++;
+			candidate_count++;
+		}
+
+		last_position[in_data[i]] = i;
+	}
+
+	return call_count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Replays the recorded calls until the minimum benchmark time elapses. Returns the time of one pass in seconds,
+// the sum of the returned lengths (compared bytes of one pass) is stored in out_length_sum.
+static double MeasureKernel(match_length_function in_function, const unsigned char* in_data, const MatchLengthCall* in_calls, int in_call_count, uint64_t* out_length_sum)
+{
+	clock_t start = clock();
+	double seconds;
+	uint64_t length_sum;
+	int pass_count = 0;
+	int i;
+
+	do
+	{
+		length_sum = 0;
+		for (i = 0; i < in_call_count; i++)
+			length_sum += in_function(in_data, in_calls[i].Position, in_calls[i].Match, 0, in_calls[i].MaxLength);
+
+		pass_count++;
+		seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+	} while (seconds < MIN_BENCH_TIME);
+
+	*out_length_sum = length_sum;
+
+	return seconds / pass_count;
+}